@@ -0,0 +1,299 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+#include <boost/program_options.hpp>
+#include <boost/json.hpp>
+#include <string>
+#include <torch/script.h>
+
+#include "game.hpp"
+#include "mcts_bot.hpp"
+#include "inference_server.hpp"
+
+
+namespace po = boost::program_options;
+namespace json = boost::json;
+
+/* allocations through operator new, so that benchmarks can report how many
+each operation makes. Memory libtorch takes from its own allocator, such as
+tensor storage, isn't counted. */
+std::atomic<long> allocations(0);
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+/* positions reached by seeded random play, so every run measures the same set */
+template <int N>
+std::vector<tak_game_t<N>> bench_positions(int depth, int n) {
+    std::vector<tak_game_t<N>> positions;
+    srand(depth + 1);
+    while (positions.size() < n) {
+        tak_game_t<N> game = new_tak_game<N>();
+        for (int d = 0; d < depth && game_outcome(&game) == IN_PROGRESS; d++) {
+            move_list_t<N> moves;
+            available_moves(&game, &moves);
+            tak_game_t<N> next;
+            apply_move(&next, &game, moves.moves[rand() % moves.size]);
+            game = next;
+        }
+        if (game_outcome(&game) == IN_PROGRESS) {
+            positions.push_back(game);
+        }
+    }
+    return positions;
+}
+
+/* stand-in for a trained network with the same input and output shapes, so
+that get_eval can be measured without a model file */
+template <int N>
+model_t dummy_model() {
+    model_t model("dummy");
+    model.define(
+        "def forward(self, x):\n"
+        "    s = x.flatten(1).sum(1, keepdim=True)\n"
+        "    return torch.tanh(s), s.expand([x.size(0), " + std::to_string(POLICY_SIZE<N>) + "])\n");
+    return model;
+}
+
+typedef struct {
+    std::string name;
+    long iterations; // operations timed
+    double ns_per_op;
+    double allocs_per_op;
+} bench_result_t;
+
+// results are folded in here so the compiler can't drop the timed work
+volatile uint64_t sink;
+
+/* time fn, which performs some operations and returns how many, repeating it
+until min_time seconds have passed */
+bench_result_t run_bench(std::string name, double min_time, std::function<long()> fn) {
+    fn(); // warm up
+    long ops = 0;
+    long allocs = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < min_time) {
+        ops += fn();
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    allocs = allocations.load() - allocs;
+    bench_result_t res = {name, ops, elapsed * 1e9 / ops, (double) allocs / ops};
+    std::cout << name << std::string(std::max(1, 36 - (int) name.size()), ' ')
+        << res.ns_per_op << " ns/op  " << res.allocs_per_op << " allocs/op  (" << ops << " ops)" << std::endl;
+    return res;
+}
+
+void tag_invoke(json::value_from_tag, json::value &jv, bench_result_t const &res) {
+    jv = {
+        {"name", res.name},
+        {"iterations", res.iterations},
+        {"real_time", res.ns_per_op},
+        {"time_unit", "ns"},
+        {"items_per_second", 1e9 / res.ns_per_op},
+        {"allocs_per_op", res.allocs_per_op},
+    };
+}
+
+int main(int ac, char* av[]) {
+    po::options_description desc("Allowed options");
+    double min_time;
+    int n_positions;
+    int playouts;
+    int board_size;
+    std::string out;
+    desc.add_options()
+        ("help", "produce help message")
+        ("min-time", po::value<double>(&min_time)->default_value(0.5), "seconds to run each benchmark for")
+        ("positions", po::value<int>(&n_positions)->default_value(256), "positions measured at each depth")
+        ("playouts", po::value<int>(&playouts)->default_value(20000), "playouts for each search benchmark")
+        ("out", po::value<std::string>(&out)->default_value("bench.json"), "file to write the results to as json")
+        ("size", po::value<int>(&board_size)->default_value(4), "board size, from 3 to 8")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(ac, av, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        std::cout << desc << "\n";
+        return 0;
+    }
+
+    if (!check_board_size(board_size)) {
+        return -1;
+    }
+    if (n_positions < 1) {
+        std::cerr << "--positions must be at least 1\n";
+        return -1;
+    }
+
+    std::vector<bench_result_t> results;
+    std::vector<int> depths = {0, 4, 8, 16, 32};
+
+    with_board_size(board_size, [&](auto size) {
+        constexpr int N = decltype(size)::value;
+        for (int depth: depths) {
+            std::vector<tak_game_t<N>> positions = bench_positions<N>(depth, n_positions);
+            std::string suffix = "/depth:" + std::to_string(depth);
+
+            std::vector<move_list_t<N>> move_lists(positions.size());
+            for (int p = 0; p < positions.size(); p++) {
+                available_moves(&positions[p], &move_lists[p]);
+            }
+
+            results.push_back(run_bench("available_moves" + suffix, min_time, [&] {
+                move_list_t<N> moves;
+                for (tak_game_t<N> &game: positions) {
+                    available_moves(&game, &moves);
+                    sink += moves.size;
+                }
+                return (long) positions.size();
+            }));
+
+            results.push_back(run_bench("apply_move" + suffix, min_time, [&] {
+                long ops = 0;
+                tak_game_t<N> next;
+                for (int p = 0; p < positions.size(); p++) {
+                    for (int k = 0; k < move_lists[p].size; k++) {
+                        apply_move(&next, &positions[p], move_lists[p].moves[k]);
+                        sink += next.hash;
+                    }
+                    ops += move_lists[p].size;
+                }
+                return ops;
+            }));
+
+            results.push_back(run_bench("make_unmake" + suffix, min_time, [&] {
+                long ops = 0;
+                for (int p = 0; p < positions.size(); p++) {
+                    tak_game_t<N> game = positions[p];
+                    for (int k = 0; k < move_lists[p].size; k++) {
+                        undo_t<N> undo;
+                        make_move(&game, move_lists[p].moves[k], &undo);
+                        sink += game.hash;
+                        unmake_move(&game, move_lists[p].moves[k], &undo);
+                    }
+                    ops += move_lists[p].size;
+                }
+                return ops;
+            }));
+
+            results.push_back(run_bench("game_outcome" + suffix, min_time, [&] {
+                for (tak_game_t<N> &game: positions) {
+                    sink += game_outcome(&game);
+                }
+                return (long) positions.size();
+            }));
+
+            results.push_back(run_bench("tiles_eval" + suffix, min_time, [&] {
+                for (tak_game_t<N> &game: positions) {
+                    sink += tiles_eval(&game) > 0;
+                }
+                return (long) positions.size();
+            }));
+
+            results.push_back(run_bench("encode_board" + suffix, min_time, [&] {
+                float board[N][N][BOARD_DEPTH];
+                for (tak_game_t<N> &game: positions) {
+                    encode_board(board, &game);
+                    sink += board[0][0][0] > 0;
+                }
+                return (long) positions.size();
+            }));
+
+            evaluator_t<N> eval = {NULL, 1};
+            results.push_back(run_bench("search/uniform" + suffix, min_time, [&] {
+                srand(depth);
+                mcts_tree_t<N> *tree = new_mcts(positions[0], &eval);
+                get_move(tree, playouts);
+                free_mcts(tree);
+                return (long) playouts;
+            }));
+        }
+
+        /* network evaluation through the dummy model, per position; after the
+        warm up grows the workspace, allocations come only from the forward pass */
+        model_t model = dummy_model<N>();
+        inference_workspace_t<N> workspace;
+        std::vector<int> batch_sizes = {1, 16, 64};
+        // a position for each request of the largest batch, even with fewer --positions
+        std::vector<tak_game_t<N>> positions = bench_positions<N>(8, std::max(n_positions, batch_sizes.back()));
+        for (int batch_size: batch_sizes) {
+            std::vector<move_list_t<N>> move_lists(batch_size);
+            std::vector<eval_request_t<N>> requests(batch_size);
+            std::vector<float> ps(batch_size * MAX_MOVES<N>);
+            for (int b = 0; b < batch_size; b++) {
+                available_moves(&positions[b], &move_lists[b]);
+                requests[b] = {&positions[b], move_lists[b].moves, move_lists[b].size, &ps[b * MAX_MOVES<N>], 0};
+            }
+            results.push_back(run_bench("get_eval/batch:" + std::to_string(batch_size), min_time, [&] {
+                get_eval(model, &workspace, requests.data(), batch_size);
+                sink += requests[0].val > 0;
+                return (long) batch_size;
+            }));
+
+            /* the same batch sent to an inference server, as self-play does with
+            several games per process; counts the allocations of both threads */
+            inference_server_t<N> *server = new_inference_server<N>(&model, batch_size, 1000);
+            evaluator_t<N> server_eval = {NULL, batch_size, 1, server};
+            results.push_back(run_bench("server_eval/batch:" + std::to_string(batch_size), min_time, [&] {
+                evaluate_batch(&server_eval, &workspace, requests.data(), batch_size);
+                sink += requests[0].val > 0;
+                return (long) batch_size;
+            }));
+            free_inference_server(server);
+        }
+
+        evaluator_t<N> eval = {&model, 16};
+        results.push_back(run_bench("search/model/batch:16", min_time, [&] {
+            srand(0);
+            mcts_tree_t<N> *tree = new_mcts(new_tak_game<N>(), &eval);
+            get_move(tree, playouts / 10);
+            free_mcts(tree);
+            return (long) playouts / 10;
+        }));
+    });
+
+    json::value context = {
+        {"executable", av[0]},
+        {"min_time", min_time},
+        {"positions", n_positions},
+        {"playouts", playouts},
+        {"size", board_size},
+    };
+    std::ofstream file(out);
+    file << json::value({{"context", context}, {"benchmarks", json::value_from(results)}}) << std::endl;
+    std::cout << "wrote " << out << std::endl;
+}
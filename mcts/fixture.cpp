@@ -0,0 +1,70 @@
+#include <iostream>
+#include <fstream>
+
+#include <boost/program_options.hpp>
+#include <string>
+
+#include "game.hpp"
+#include "mcts_bot.hpp"
+
+
+namespace po = boost::program_options;
+
+/* Writes the same self-play positions as a record stream (<out>.bin), a
+training shard (<out>.shard) and json (<out>.json), for model/test_records.py
+to check that the binary formats decode to the boards, moves and visit
+distributions the json encoders give. The games are played by short
+searches with tiles_eval and uniform priors, so no model is needed, and on
+4x4 boards, the only size json is written for. */
+int main(int ac, char* av[]) {
+    po::options_description desc("Allowed options");
+    int n_games;
+    int iter;
+    unsigned seed;
+    std::string out_prefix;
+    desc.add_options()
+        ("help", "produce help message")
+        ("ngames,n", po::value<int>(&n_games)->default_value(8), "number of games")
+        ("iter", po::value<int>(&iter)->default_value(16), "number of mcts iterations")
+        ("seed", po::value<unsigned>(&seed)->default_value(0), "random seed")
+        ("out", po::value<std::string>(&out_prefix)->default_value("fixture"), "prefix of the output files")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(ac, av, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        std::cout << desc << "\n";
+        return 0;
+    }
+
+    constexpr int N = 4;
+    srand(seed);
+    evaluator_t<N> eval = {NULL, 1, 1};
+    search_limits_t limits = move_limits(iter, 0, true);
+
+    std::ofstream records(out_prefix + ".bin", std::ios::binary);
+    std::ofstream json(out_prefix + ".json");
+    shard_writer_t<N> *shard = new_shard_writer<N>(out_prefix + ".shard");
+    if (!records || !json || shard == NULL) {
+        std::cerr << "could not create the output files\n";
+        return -1;
+    }
+
+    write_record_header<N>(records);
+    json << "[";
+    for (int i = 0; i < n_games; i++) {
+        std::vector<search_record_t<N>> game = simulate(new_tak_game<N>(), limits, &eval);
+        for (search_record_t<N> &record: game) {
+            write_record(records, &record);
+            shard_write(shard, &record);
+        }
+        write_json_records(game, json);
+    }
+    // delete the last comma so json is valid
+    json.seekp(-1, std::ios::cur);
+    json << "]";
+    close_shard_writer(shard);
+    return 0;
+}
@@ -7,28 +7,73 @@
 
 #include "game.hpp"
 #include "mcts_bot.hpp"
+#include "inference_server.hpp"
+#include "eval_cache.hpp"
 
 
 namespace po = boost::program_options;
 
-/* simulate games */
-void task(std::string filename, int n_games, int iter, model_t model, bool mcts, tak_game_t game) {
+typedef enum {
+    OUTPUT_RECORDS,
+    OUTPUT_SHARD,
+    OUTPUT_JSON
+} output_format_t;
+
+static const char *OUTPUT_EXTENSIONS[] = {".bin", ".shard", ".json"};
+
+/* simulate games, writing each one out as soon as it ends; a shard is only
+readable once every game has been written */
+template <int N>
+void task(std::string filename, int n_games, search_limits_t limits, evaluator_t<N> *eval, tak_game_t<N> game, output_format_t format) {
     std::ofstream file;
-    file.open(filename);
+    shard_writer_t<N> *shard = NULL;
+    if (format == OUTPUT_SHARD) {
+        shard = new_shard_writer<N>(filename);
+        if (shard == NULL) {
+            std::cerr << "could not create " << filename << "\n";
+            return;
+        }
+    } else {
+        file.open(filename, std::ios::binary);
+    }
 
-    file << "[";
+    if (format == OUTPUT_JSON) {
+        file << "[";
+    } else if (format == OUTPUT_RECORDS) {
+        write_record_header<N>(file);
+    }
     for (int i = 0; i < n_games; i++) {
         if (i % 5 == 0) {
             std::cout << "iter " << i << " / " << n_games << std::endl;
 
         }
-        simulate(game, iter, file, model, !mcts);
+        std::vector<search_record_t<N>> records = simulate(game, limits, eval);
+        switch (format) {
+            case OUTPUT_JSON:
+                write_json_records(records, file);
+                break;
+            case OUTPUT_SHARD:
+                for (search_record_t<N> &record: records) {
+                    shard_write(shard, &record);
+                }
+                break;
+            case OUTPUT_RECORDS:
+                for (search_record_t<N> &record: records) {
+                    write_record(file, &record);
+                }
+                file.flush();
+                break;
+        }
     }
 
-    // delete the last comma so json is valid
-    long pos = file.tellp();
-    file.seekp(pos - 1);
-    file << "]";       
+    if (format == OUTPUT_JSON) {
+        // delete the last comma so json is valid
+        long pos = file.tellp();
+        file.seekp(pos - 1);
+        file << "]";
+    } else if (format == OUTPUT_SHARD) {
+        close_shard_writer(shard);
+    }
 }
 
 int main(int ac, char* av[]) {
@@ -38,6 +83,14 @@ int main(int ac, char* av[]) {
     po::options_description desc("Allowed options");
     int iter;
     int nthreads;
+    int batch_size;
+    int n_workers;
+    int timeout_us;
+    int cache_size;
+    double move_time;
+    int memory_mb;
+    int board_size;
+    std::string out_prefix;
     desc.add_options()
         ("help", "produce help message")
         ("ngames,n", po::value<int>(), "number of games")
@@ -47,6 +100,17 @@ int main(int ac, char* av[]) {
         ("mcts", "use mcts for single-bot simulation")
         ("iter", po::value<int>(&iter)->default_value(10), "number of mcts iterations")
         ("nthread", po::value<int>(&nthreads)->default_value(1), "number of mcts iterations")
+        ("batch", po::value<int>(&batch_size)->default_value(1), "number of leaves evaluated per forward pass")
+        ("workers", po::value<int>(&n_workers)->default_value(1), "number of threads searching each tree")
+        ("timeout", po::value<int>(&timeout_us)->default_value(1000), "microseconds the inference thread waits to fill a batch")
+        ("cache", po::value<int>(&cache_size)->default_value(1 << 16), "number of network evaluations cached (0 to disable)")
+        ("time", po::value<double>(&move_time)->default_value(0), "seconds of search per move (0 for no limit)")
+        ("memory", po::value<int>(&memory_mb)->default_value(0), "MB each search tree may hold (0 for no limit)")
+        ("early-stop", "stop searching once the best move can't change")
+        ("json", "write the games as json rather than binary records")
+        ("shard", "write the games as a training shard rather than a record stream")
+        ("out", po::value<std::string>(&out_prefix)->default_value("out"), "prefix of the output files")
+        ("size", po::value<int>(&board_size)->default_value(4), "board size, from 3 to 8")
     ;
     
 
@@ -57,6 +121,14 @@ int main(int ac, char* av[]) {
     bool mcts = vm.count("mcts") > 0;
     bool oppose = vm.count("oppose") > 0;
 
+    if (!check_board_size(board_size)) {
+        return -1;
+    }
+    if (vm.count("json") && board_size != 4) {
+        std::cerr << "json output is only written for 4x4 games\n";
+        return -1;
+    }
+
     model_t model1;
     if (!mcts || oppose) {
         if (vm.count("model1")) {
@@ -101,43 +173,74 @@ int main(int ac, char* av[]) {
         n_games = vm["ngames"].as<int>();
     }
 
-    tak_game_t game = new_tak_game();
+    search_limits_t limits = move_limits(iter, move_time, !vm["iter"].defaulted());
+    limits.memory = (size_t) memory_mb << 20;
+    limits.early_stop = vm.count("early-stop") > 0;
+    output_format_t format = OUTPUT_RECORDS;
+    if (vm.count("json")) {
+        format = OUTPUT_JSON;
+    } else if (vm.count("shard")) {
+        format = OUTPUT_SHARD;
+    }
 
-    if (oppose) {
-        int dnn_wins = 0;
-        int mcts_wins = 0;
-        for (int i = 0; i < n_games; i++) {
-            if (i % 50 == 0) {
-                std::cout << "iter " << i << " / " << n_games << std::endl;
-            }
-            int res = oppose_bots(game, iter, model1, model2, false);
-            if (res == 1) {
-                dnn_wins++;
-            } else if (res == 2) {
-                mcts_wins++;
+    with_board_size(board_size, [&](auto size) {
+        constexpr int N = decltype(size)::value;
+        tak_game_t<N> game = new_tak_game<N>();
+
+        if (oppose) {
+            evaluator_t<N> eval1 = {&model1, batch_size, n_workers};
+            evaluator_t<N> eval2 = {&model2, batch_size, n_workers};
+            int dnn_wins = 0;
+            int mcts_wins = 0;
+            for (int i = 0; i < n_games; i++) {
+                if (i % 50 == 0) {
+                    std::cout << "iter " << i << " / " << n_games << std::endl;
+                }
+                int res = oppose_bots(game, limits, &eval1, &eval2);
+                if (res == 1) {
+                    dnn_wins++;
+                } else if (res == 2) {
+                    mcts_wins++;
+                }
             }
-        }
-        std::cout << "FINAL RESULT: dnn - " << dnn_wins << " , mcts - " << mcts_wins << std::endl;
-    } else {
-        if (nthreads == 1) {
-            task("out.json", n_games, iter, model1, mcts, game);
+            std::cout << "FINAL RESULT: dnn - " << dnn_wins << " , mcts - " << mcts_wins << std::endl;
         } else {
-            std::vector<std::thread*> all_threads;
-            int games_per_thread = n_games / nthreads;
-            for (int t = 0; t < nthreads; t++) {
-                std::ostringstream stream;
-                stream << "out" << t << ".json";
-                std::string filename = stream.str();
-                std::cout << filename <<"\n";
-                std::thread *new_thread = new std::thread(task, filename, games_per_thread, iter, model1, mcts, game);
-                all_threads.push_back(new_thread);
+            evaluator_t<N> eval = {mcts ? NULL : &model1, batch_size, n_workers};
+            if (!mcts && cache_size > 0) {
+                eval.cache = new_eval_cache(cache_size);
             }
-
-            for (int i = 0; i < all_threads.size(); i++) {
-                all_threads[i]->join();
-                delete all_threads[i];
+            if (!mcts && nthreads > 1) {
+                /* evaluate the leaves of every game thread together on one
+                inference thread, so forward passes batch across games */
+                eval.server = new_inference_server<N>(&model1, nthreads * n_workers * batch_size, timeout_us);
             }
+            if (nthreads == 1) {
+                task(out_prefix + OUTPUT_EXTENSIONS[format], n_games, limits, &eval, game, format);
+            } else {
+                std::vector<std::thread*> all_threads;
+                int games_per_thread = n_games / nthreads;
+                for (int t = 0; t < nthreads; t++) {
+                    std::ostringstream stream;
+                    stream << out_prefix << t << OUTPUT_EXTENSIONS[format];
+                    std::string filename = stream.str();
+                    std::cout << filename <<"\n";
+                    std::thread *new_thread = new std::thread(task<N>, filename, games_per_thread, limits, &eval, game, format);
+                    all_threads.push_back(new_thread);
+                }
+
+                for (int i = 0; i < all_threads.size(); i++) {
+                    all_threads[i]->join();
+                    delete all_threads[i];
+                }
+                if (eval.server != NULL) {
+                    free_inference_server(eval.server);
+                }
 
+            }
+            if (eval.cache != NULL) {
+                std::cout << "cache hits: " << eval.cache->hits << " , misses: " << eval.cache->misses << std::endl;
+                free_eval_cache(eval.cache);
+            }
         }
-    }  
-}
\ No newline at end of file
+    });
+}
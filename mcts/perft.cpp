@@ -0,0 +1,238 @@
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <thread>
+
+#include <boost/program_options.hpp>
+#include <string>
+
+#include "game.hpp"
+
+
+namespace po = boost::program_options;
+
+/* leaf counts from the start position under the standard rules, which
+other Tak engines agree on, by board size; used by --check */
+static const std::vector<long> START_COUNTS[MAX_BOARD_SIZE + 1] = {
+    {}, {}, {}, {},
+    {1, 16, 240, 7440, 216464, 6468872, 181954216},
+    {1, 25, 600, 43320, 2999784, 187855252},
+    {1, 36, 1260, 132720, 13586048, 1253506520},
+    {}, {},
+};
+
+/* move strings as typed in the TUI, the position they are played in and the
+board they lead to, or NULL where the string must be refused; used by --check */
+typedef struct {
+    const char *tps;
+    const char *str;
+    const char *board;
+} move_case_t;
+
+static const std::vector<move_case_t> MOVE_CASES[MAX_BOARD_SIZE + 1] = {
+    {}, {}, {}, {},
+    {
+        // there are no capstones to place
+        {"x4/x4/x4/x4 1 1", "ca1", NULL},
+        // d0 counts the pieces left behind, though the policy head caps it
+        {"x4/x4/x4/121212121,x3 1 10", "ma1d6", "x4/x4/x4/121212,1,2,1"},
+        {"x4/x4/x4/121212121,x3 1 10", "ma1d0", NULL},
+    },
+    {
+        // a tower of 7, taller than the 5 pieces a move can carry
+        {"x5/x5/x5/x5/1212121,x4 1 10", "ma1d2", "x5/x5/x5/x5/12,1,2,1,21"},
+        {"x5/x5/x5/x5/1212121,x4 1 10", "ma1d41", "x5/x5/x5/x5/1212,1,2,1,x"},
+        {"x5/x5/x5/x5/1212121,x4 1 10", "fb2", "x5/x5/x5/x,1,x3/1212121,x4"},
+        {"x5/x5/x5/x5/1212121,x4 1 10", "ma1d0", NULL}, // carries all 7
+        {"x5/x5/x5/x5/1212121,x4 1 10", "ma1d9", NULL}, // leaves more than the tower
+        {"x5/x5/x5/x5/1212121,x4 1 10", "ma1d53", NULL}, // drops more than is left
+        {"x5/x5/x5/x5/1212121,x4 1 10", "ma1d20", NULL}, // drops nothing on b1
+        {"x5/x5/x5/x5/1212121,x4 1 10", "ma1w", NULL}, // off the board
+    },
+    {}, {}, {},
+};
+
+/* play each of MOVE_CASES, printing those that don't go as expected */
+template <int N>
+bool check_move_strings() {
+    bool ok = true;
+    for (const move_case_t &c: MOVE_CASES[N]) {
+        tak_game_t<N> game;
+        move_t move;
+        game_from_tps(c.tps, &game);
+        std::string board = "refused";
+        if (move_from_string(c.str, &game, &move)) {
+            tak_game_t<N> next;
+            apply_move(&next, &game, move);
+            std::string tps = game_to_tps(&next);
+            board = tps.substr(0, tps.find(' '));
+        }
+        std::string expected = c.board != NULL ? c.board : "refused";
+        if (board != expected) {
+            std::cout << "move " << c.str << " from " << c.tps << ": " << board
+                << ", expected " << expected << "\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/* count the positions reached after exactly `depth` moves, walking a
+single game with make_move and unmake_move. No moves are generated once the
+game is over, so finished games add nothing below them. */
+template <int N>
+long perft(tak_game_t<N> *game, int depth) {
+    if (depth == 0) {
+        return 1;
+    }
+    if (game_outcome(game) != IN_PROGRESS) {
+        return 0;
+    }
+    move_list_t<N> moves;
+    available_moves(game, &moves);
+    if (depth == 1) {
+        return moves.size;
+    }
+    long nodes = 0;
+    for (int k = 0; k < moves.size; k++) {
+        undo_t<N> undo;
+        make_move(game, moves.moves[k], &undo);
+        nodes += perft(game, depth - 1);
+        unmake_move(game, moves.moves[k], &undo);
+    }
+    return nodes;
+}
+
+/* name a move as in the TUI: f/w/c/m, the square, then for tower moves the
+direction (w/a/s/d) and the drops given by the packed move */
+template <int N>
+std::string move_name(move_t move) {
+    move_info_t info = unpack_move<N>(move);
+    std::string name;
+    name += info.move == FLAT ? 'f' : info.move == WALL ? 'w' : info.move == CAP ? 'c' : 'm';
+    name += (char) ('a' + info.i);
+    name += (char) ('1' + info.j);
+    if (info.move == MOVE) {
+        name += info.dj == -1 ? 'w' : info.dj == 1 ? 's' : info.di == -1 ? 'a' : 'd';
+        if (LEGACY_DROPS<N>) {
+            for (int c = 0; c < N - 1; c++) {
+                name += (char) ('0' + info.drops[c]);
+            }
+        } else {
+            // the pieces dropped on each square, without those left behind
+            for (int c = 1; c < N && info.drops[c] > 0; c++) {
+                name += (char) ('0' + info.drops[c]);
+            }
+        }
+    }
+    return name;
+}
+
+/* perft split over the root moves, which threads take in turn; counts holds
+the count below each root move */
+template <int N>
+long perft_root(tak_game_t<N> *game, int depth, int n_threads, std::vector<long> &counts) {
+    move_list_t<N> moves;
+    available_moves(game, &moves);
+    counts.assign(moves.size, 0);
+    if (depth == 0 || game_outcome(game) != IN_PROGRESS) {
+        return depth == 0;
+    }
+
+    std::atomic<int> next(0);
+    auto worker = [&] {
+        for (int k = next++; k < moves.size; k = next++) {
+            tak_game_t<N> child;
+            apply_move(&child, game, moves.moves[k]);
+            counts[k] = perft(&child, depth - 1);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < n_threads; t++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+
+    long nodes = 0;
+    for (long count: counts) {
+        nodes += count;
+    }
+    return nodes;
+}
+
+int main(int ac, char* av[]) {
+    po::options_description desc("Allowed options");
+    int depth;
+    int n_threads;
+    int board_size;
+    std::string tps;
+    desc.add_options()
+        ("help", "produce help message")
+        ("depth,d", po::value<int>(&depth)->default_value(5), "number of moves to search")
+        ("tps", po::value<std::string>(&tps), "position to start from, in TPS notation (default: the start position)")
+        ("divide", "print the count below each root move at the final depth")
+        ("nthread", po::value<int>(&n_threads)->default_value(1), "number of threads")
+        ("check", "compare the counts from the start position against known values, on 4x4 to 6x6, and check how move strings are read")
+        ("size", po::value<int>(&board_size)->default_value(4), "board size, from 3 to 8")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(ac, av, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        std::cout << desc << "\n";
+        return 0;
+    }
+
+    if (!check_board_size(board_size)) {
+        return -1;
+    }
+
+    bool failed = false;
+    with_board_size(board_size, [&](auto size) {
+        constexpr int N = decltype(size)::value;
+        tak_game_t<N> game = new_tak_game<N>();
+        if (vm.count("tps") && !game_from_tps(tps, &game)) {
+            std::cerr << "invalid position: " << tps << "\n";
+            failed = true;
+            return;
+        }
+        std::cout << game_to_tps(&game) << "\n";
+
+        bool check = vm.count("check") > 0 && !vm.count("tps");
+        const std::vector<long> &known = START_COUNTS[N];
+        std::vector<long> counts;
+        for (int d = 1; d <= depth; d++) {
+            auto start = std::chrono::steady_clock::now();
+            long nodes = perft_root(&game, d, n_threads, counts);
+            double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::cout << "depth " << d << "  nodes " << nodes << "  " << std::fixed << std::setprecision(3)
+                << s << "s  " << std::setprecision(2) << nodes / s / 1e6 << " Mnps";
+            if (check && d < (int) known.size()) {
+                bool ok = nodes == known[d];
+                failed = failed || !ok;
+                std::cout << (ok ? "  ok" : "  MISMATCH, expected " + std::to_string(known[d]));
+            }
+            std::cout << std::endl;
+        }
+
+        if (check && !check_move_strings<N>()) {
+            failed = true;
+        }
+
+        if (vm.count("divide")) {
+            move_list_t<N> moves;
+            available_moves(&game, &moves);
+            for (size_t k = 0; k < counts.size(); k++) {
+                std::cout << move_name<N>(moves.moves[k]) << ": " << counts[k] << "\n";
+            }
+        }
+    });
+    return failed ? 1 : 0;
+}
@@ -1,80 +1,184 @@
 #include "ai_model.hpp"
+#include "inference_server.hpp"
+#include "eval_cache.hpp"
 #include <math.h>
-#define WALL_OFFSET 10
-
-void encode_board(float encoded_board[][4][9], uint8_t board[][4][9]) {
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            for (int k = 0; k < 9; k++) {
-                switch (board[i][j][k]) {
-                    case 1:
-                        encoded_board[i][j][k] = -1.;
-                        break;
-                    case 2:
-                        encoded_board[i][j][k] = 1.;
-                        break;
-                    case WALL_OFFSET + 1:
-                        encoded_board[i][j][k] = -2.;
-                        break;
-                    case WALL_OFFSET + 2:
-                        encoded_board[i][j][k] = 2.;
-                        break;
-                    default:
-                        encoded_board[i][j][k] = 0.;
-                        break;
-                }
-            }
+#include <algorithm>
+
+/* the pieces of a stack as network input, by table lookup on its packed
+owners and height: p2[o][k] is 1 if the k-th piece from the top of the low
+8 owner bits o is p2's, and present[h][k] is 1 for the top h pieces, with
+any height past BOARD_DEPTH looked up as BOARD_DEPTH. The owner of the
+last piece shown is read from the stack itself. */
+struct plane_table_t {
+    float p2[256][BOARD_DEPTH - 1];
+    float present[BOARD_DEPTH + 1][BOARD_DEPTH];
+};
+
+static constexpr plane_table_t make_planes() {
+    plane_table_t planes = {};
+    for (int o = 0; o < 256; o++) {
+        for (int k = 0; k < BOARD_DEPTH - 1; k++) {
+            planes.p2[o][k] = (o >> k) & 1;
+        }
+    }
+    for (int h = 0; h <= BOARD_DEPTH; h++) {
+        for (int k = 0; k < h; k++) {
+            planes.present[h][k] = 1;
+        }
+    }
+    return planes;
+}
+
+static constexpr plane_table_t PLANES = make_planes();
+
+template <int N>
+void encode_board(float encoded_board[][N][BOARD_DEPTH], const tak_game_t<N> *game) {
+    // from the side to move, as model/dataset.py encodes positions for training
+    float sign = game->turn == 2 ? -1 : 1;
+    float *out = &encoded_board[0][0][0];
+    for (int sq = 0; sq < N * N; sq++, out += BOARD_DEPTH) {
+        stack_word_t<N> stack = game->stacks[sq];
+        // the height marker lands in p2 where present is 0, so it drops out
+        const float *p2 = PLANES.p2[(int) (stack & 0xFF)];
+        const float *present = PLANES.present[std::min(STACK_HEIGHT(stack), BOARD_DEPTH)];
+        /* 2 * p2 * present - present rather than (2 * p2 - 1) * present, so
+        that empty places are +0 before the sign, like the Python decoders */
+        for (int k = 0; k < BOARD_DEPTH - 1; k++) {
+            out[k] = (2 * p2[k] * present[k] - present[k]) * sign;
         }
+        constexpr int last = BOARD_DEPTH - 1;
+        float p2_last = (float) (int) ((stack >> last) & 1);
+        out[last] = (2 * p2_last * present[last] - present[last]) * sign;
+        out[0] *= 1 + ((game->walls >> sq) & 1) + 2 * ((game->caps >> sq) & 1);
     }
 }
 
-void softmax(std::vector<float> &arr) {
+/* softmax over the logits of the legal moves, which is the policy head's
+softmax with every illegal move masked out. The loops are kept separate and
+branch-free so that the compiler can vectorize them. */
+void softmax(float *arr, int n) {
+    float max = -INFINITY;
+    for (int i = 0; i < n; i++) {
+        max = std::max(max, arr[i]);
+    }
+
+    for (int i = 0; i < n; i++) {
+        arr[i] = expf(arr[i] - max);
+    }
+
     float tot = 0;
-    for (int i = 0; i < arr.size(); i++) {
-        float x = exp(arr[i]);
-        arr[i] = x;
-        tot += x;
+    for (int i = 0; i < n; i++) {
+        tot += arr[i];
+    }
+
+    float scale = 1 / tot;
+    for (int i = 0; i < n; i++) {
+        arr[i] *= scale;
+    }
+}
+
+/* the input for a batch of n boards, growing the workspace if needed */
+template <int N>
+const torch::jit::IValue &batch_input(inference_workspace_t<N> *workspace, int n) {
+    if (n >= (int) workspace->views.size()) {
+        // grow geometrically so that slowly growing batches reallocate rarely
+        int capacity = std::max(n, 2 * ((int) workspace->views.size() - 1));
+        auto options = torch::TensorOptions().dtype(torch::kF32);
+        workspace->input = torch::empty({capacity, N, N, BOARD_DEPTH}, options);
+        workspace->views.assign(capacity + 1, torch::jit::IValue());
+    }
+    if (workspace->views[n].isNone()) {
+        workspace->views[n] = workspace->input.narrow(0, 0, n);
     }
+    return workspace->views[n];
+}
+
+template <int N>
+void get_eval(model_t &module, inference_workspace_t<N> *workspace, eval_request_t<N> *requests, int n) {
+    constexpr int board_size = N * N * BOARD_DEPTH;
+    const torch::jit::IValue &input = batch_input(workspace, n);
+    torch::Tensor &storage = workspace->input;
+    float *boards = storage.data_ptr<float>();
+    for (int b = 0; b < n; b++) {
+        encode_board<N>((float (*)[N][BOARD_DEPTH]) &boards[b * board_size], requests[b].game);
+    }
+
+    // Method::run works on the stack in place, where forward() would copy its arguments
+    workspace->stack.clear();
+    workspace->stack.push_back(input);
+    module.get_method("forward").run(workspace->stack);
+    const auto &outputs = workspace->stack.back().toTuple()->elements();
+    torch::Tensor output1 = outputs[0].toTensor().to(torch::kF32).contiguous();
+    torch::Tensor output2 = outputs[1].toTensor().to(torch::kF32).contiguous();
+
+    /* read the outputs straight from memory rather than through a tensor view
+    per move: values are [n, 1] and the policy is [n, POLICY_SIZE<N>] once flattened */
+    const float *vals = output1.data_ptr<float>();
+    const float *logits = output2.data_ptr<float>();
 
-    for (int i = 0; i < arr.size(); i++) {
-        arr[i] /= tot;
+    for (int b = 0; b < n; b++) {
+        eval_request_t<N> *req = &requests[b];
+        req->val = vals[b];
+
+        // packed moves are indices into the flattened policy head
+        const float *policy = logits + (size_t) b * POLICY_SIZE<N>;
+        for (int k = 0; k < req->n_moves; k++) {
+            req->ps[k] = policy[req->moves[k]];
+        }
+        softmax(req->ps, req->n_moves);
     }
 }
 
-float get_eval(model_t &module, tak_game_t *game, std::vector<move_t> &moves, std::vector<float> &ps) {
-    float board[4][4][9];
-    encode_board(board, game->board);
-    
-    auto options = torch::TensorOptions().dtype(torch::kF32);
-    torch::Tensor B = torch::from_blob(board, {1,4,4,9}, options);
-    std::vector<torch::jit::IValue> inputs;
-    inputs.push_back(B);
-
-    auto output = module.forward(inputs);
-    auto output1 = output.toTuple()->elements()[0].toTensor();
-    auto output2 = output.toTuple()->elements()[1].toTensor();
-
-    float val = output1[0].item<float>();
-
-    for (auto m: moves) {
-        float p;
-        switch (m.move) {
-            case FLAT:
-                p = output2[0][m.i][m.j][0][0][0][0].item<float>();
-                break;
-            case WALL:
-                p = output2[0][m.i][m.j][1][0][0][0].item<float>();
-                break;
-            case MOVE:
-                int idx = 2;
-                if (m.di == -1) {idx = 3;}
-                if (m.dj == 1) {idx = 4;}
-                if (m.dj == -1) {idx = 5;}
-                p = output2[0][m.i][m.j][idx][m.drop0][m.drop1][m.drop2].item<float>();
+/* evaluate requests with the server, the model or the fallback heuristic */
+template <int N>
+void evaluate_uncached(evaluator_t<N> *eval, inference_workspace_t<N> *workspace, eval_request_t<N> *requests, int n) {
+    if (n == 0) {
+        return;
+    }
+    if (eval->server != NULL) {
+        inference_job_t<N> job = {requests, n};
+        submit_eval(eval->server, &job);
+        return;
+    }
+    if (eval->model == NULL) {
+        for (int b = 0; b < n; b++) {
+            eval_request_t<N> *req = &requests[b];
+            std::fill_n(req->ps, req->n_moves, 1 / ((float) req->n_moves));
+            req->val = tiles_eval(req->game);
         }
-        ps.push_back(p);
+        return;
     }
-    softmax(ps);
-    
-    return val;
-}
\ No newline at end of file
+    get_eval(*eval->model, workspace, requests, n);
+}
+
+template <int N>
+void evaluate_batch(evaluator_t<N> *eval, inference_workspace_t<N> *workspace, eval_request_t<N> *requests, int n) {
+    if (eval->cache == NULL || (eval->model == NULL && eval->server == NULL)) {
+        evaluate_uncached(eval, workspace, requests, n);
+        return;
+    }
+
+    // only the positions missing from the cache go to the network
+    std::vector<eval_request_t<N>> &misses = workspace->misses;
+    std::vector<int> &miss_idx = workspace->miss_idx;
+    misses.clear();
+    miss_idx.clear();
+    for (int b = 0; b < n; b++) {
+        if (!eval_cache_lookup(eval->cache, &requests[b])) {
+            misses.push_back(requests[b]);
+            miss_idx.push_back(b);
+        }
+    }
+    evaluate_uncached(eval, workspace, misses.data(), misses.size());
+    for (int k = 0; k < misses.size(); k++) {
+        requests[miss_idx[k]].val = misses[k].val;
+        eval_cache_store(eval->cache, &misses[k]);
+    }
+}
+
+#define INSTANTIATE_AI_MODEL(N) \
+    template void encode_board<N>(float [][N][BOARD_DEPTH], const tak_game_t<N> *); \
+    template void get_eval<N>(model_t &, inference_workspace_t<N> *, eval_request_t<N> *, int); \
+    template void evaluate_batch<N>(evaluator_t<N> *, inference_workspace_t<N> *, eval_request_t<N> *, int);
+
+FOR_EACH_BOARD_SIZE(INSTANTIATE_AI_MODEL)
@@ -1,7 +1,71 @@
+#ifndef AI_MODEL_H_
+#define AI_MODEL_H_
+
 #include "game.hpp"
 #include <torch/script.h>
 
 typedef torch::jit::script::Module model_t;
 
-float get_eval(model_t &model, tak_game_t *game, std::vector<move_t> &moves, std::vector<float> &ps);
+/* a position to evaluate: val is set to its value for the player to move and
+ps to the prior of each of its n_moves moves */
+template <int N>
+struct eval_request_t {
+    tak_game_t<N> *game;
+    move_t *moves;
+    int n_moves;
+    float *ps;
+    float val;
+};
+
+/* encode a position as the network input: one value per piece, from the top
+of each stack down, with flats as -1/1, walls as -2/2 and capstones as -3/3
+for p1/p2, all negated when p2 is to move. The values are bit for bit those
+of decode_board and decode_boards in model/dataset.py, so the network sees
+the same input in self-play as in training. */
+template <int N>
+void encode_board(float encoded_board[][N][BOARD_DEPTH], const tak_game_t<N> *game);
+
+/* buffers kept from one evaluation to the next. Once they have grown to
+the largest batch seen, evaluating allocates nothing outside the model's
+forward pass: boards are encoded straight into the input tensor, each batch
+size n reuses its view of the first n boards, and the forward call runs on
+a reused interpreter stack. A workspace is used by one thread at a time. */
+template <int N>
+struct inference_workspace_t {
+    torch::Tensor input; // [capacity, N, N, BOARD_DEPTH]
+    std::vector<torch::jit::IValue> views; // views[n]: the first n boards of input, once used
+    std::vector<torch::jit::IValue> stack; // arguments of the forward call, then its result
+    std::vector<eval_request_t<N>> misses; // requests not found in the cache
+    std::vector<int> miss_idx;
+};
+
+/* evaluate a batch of positions with a single forward pass; the model takes
+[n, N, N, 9] boards and returns values and [n, POLICY_SIZE<N>] logits */
+template <int N>
+void get_eval(model_t &model, inference_workspace_t<N> *workspace, eval_request_t<N> *requests, int n);
+
+template <int N>
+struct inference_server_t;
+struct eval_cache_t;
+
+/* evaluation context shared by every search tree that uses it, so that the
+TorchScript module is held once rather than copied into each tree or node */
+template <int N>
+struct evaluator_t {
+    model_t *model; // not owned; NULL to use tiles_eval and uniform priors
+    int batch_size; // leaves the search collects for each forward pass
+    int n_workers; // threads searching each tree together; 0 or 1 to search serially
+    /* not owned; if set, positions are sent to this server's thread, which
+    batches them with those of other searches, rather than evaluated here */
+    inference_server_t<N> *server;
+    /* not owned; if set, network evaluations are cached here and reused
+    whenever a position comes up again, in this tree or any other */
+    struct eval_cache_t *cache;
+};
+
+/* evaluate requests, using the workspace for any forward pass run on the
+calling thread */
+template <int N>
+void evaluate_batch(evaluator_t<N> *eval, inference_workspace_t<N> *workspace, eval_request_t<N> *requests, int n);
 
+#endif // define AI_MODEL_H_
@@ -0,0 +1,47 @@
+#include "arena.hpp"
+#include <cstdlib>
+#include <new>
+
+#define ARENA_ALIGN alignof(std::max_align_t)
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (size > ARENA_BLOCK_SIZE) {
+        /* oversized requests get their own block, kept at the front so that
+        the last block is still the one being filled */
+        char *block = static_cast<char *>(malloc(size));
+        if (block == NULL) {
+            throw std::bad_alloc();
+        }
+        if (arena->blocks.empty()) {
+            arena->used = ARENA_BLOCK_SIZE;
+        }
+        arena->blocks.insert(arena->blocks.begin(), block);
+        arena->total += size;
+        return block;
+    }
+
+    if (arena->blocks.empty() || arena->used + size > ARENA_BLOCK_SIZE) {
+        char *block = static_cast<char *>(malloc(ARENA_BLOCK_SIZE));
+        if (block == NULL) {
+            throw std::bad_alloc();
+        }
+        arena->blocks.push_back(block);
+        arena->used = 0;
+        arena->total += ARENA_BLOCK_SIZE;
+    }
+
+    void *ptr = arena->blocks.back() + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+void arena_free(arena_t *arena) {
+    for (char *block: arena->blocks) {
+        free(block);
+    }
+    arena->blocks.clear();
+    arena->used = 0;
+    arena->total = 0;
+}
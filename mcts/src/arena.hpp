@@ -0,0 +1,31 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+/* bump allocator that hands out memory from large blocks. Allocations are
+never freed individually; everything is released at once by arena_free.
+Blocks are never moved, so pointers into the arena stay valid. */
+typedef struct {
+    std::vector<char *> blocks;
+    size_t used; // bytes used in the last block
+    size_t total; // bytes allocated over all blocks
+} arena_t;
+
+void *arena_alloc(arena_t *arena, size_t size);
+
+void arena_free(arena_t *arena);
+
+/* allocate an uninitialized array of n elements; the arena never runs
+destructors, so the type must be trivially destructible */
+template <typename T>
+T *arena_array(arena_t *arena, size_t n) {
+    static_assert(std::is_trivially_destructible<T>::value, "arena arrays are never destroyed");
+    return static_cast<T *>(arena_alloc(arena, n * sizeof(T)));
+}
+
+#endif // define ARENA_H_
@@ -0,0 +1,79 @@
+#include "eval_cache.hpp"
+#include <algorithm>
+
+#define EVAL_CACHE_LOCKS 64
+
+eval_cache_t *new_eval_cache(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+    eval_cache_t *cache = new eval_cache_t();
+    cache->entries.resize(size);
+    cache->locks = std::vector<std::mutex>(EVAL_CACHE_LOCKS);
+    cache->hits = 0;
+    cache->misses = 0;
+    return cache;
+}
+
+void free_eval_cache(eval_cache_t *cache) {
+    delete cache;
+}
+
+template <int N>
+bool eval_cache_lookup(eval_cache_t *cache, eval_request_t<N> *req) {
+    uint64_t key;
+    int sym = canonical_symmetry(req->game, &key);
+    size_t slot = key & (cache->entries.size() - 1);
+    eval_cache_entry_t *entry = &cache->entries[slot];
+
+    std::lock_guard<std::mutex> guard(cache->locks[slot % EVAL_CACHE_LOCKS]);
+    // the move count and the moves themselves guard against hash collisions
+    bool found = entry->key == key && entry->moves.size() == (size_t) req->n_moves;
+    for (int k = 0; found && k < req->n_moves; k++) {
+        move_t move = transform_move<N>(req->moves[k], sym);
+        auto it = std::lower_bound(entry->moves.begin(), entry->moves.end(), move);
+        found = it != entry->moves.end() && *it == move;
+        if (found) {
+            req->ps[k] = entry->ps[it - entry->moves.begin()];
+        }
+    }
+    if (!found) {
+        cache->misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    req->val = entry->val;
+    cache->hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+template <int N>
+void eval_cache_store(eval_cache_t *cache, const eval_request_t<N> *req) {
+    uint64_t key;
+    int sym = canonical_symmetry(req->game, &key);
+    size_t slot = key & (cache->entries.size() - 1);
+    eval_cache_entry_t *entry = &cache->entries[slot];
+
+    std::pair<move_t, float> priors[MAX_MOVES<N>];
+    for (int k = 0; k < req->n_moves; k++) {
+        priors[k] = {transform_move<N>(req->moves[k], sym), req->ps[k]};
+    }
+    std::sort(priors, priors + req->n_moves);
+
+    std::lock_guard<std::mutex> guard(cache->locks[slot % EVAL_CACHE_LOCKS]);
+    entry->key = key;
+    entry->val = req->val;
+    // reuses the slot's buffers once it has held a position with as many moves
+    entry->moves.resize(req->n_moves);
+    entry->ps.resize(req->n_moves);
+    for (int k = 0; k < req->n_moves; k++) {
+        entry->moves[k] = priors[k].first;
+        entry->ps[k] = priors[k].second;
+    }
+}
+
+#define INSTANTIATE_EVAL_CACHE(N) \
+    template bool eval_cache_lookup<N>(eval_cache_t *, eval_request_t<N> *); \
+    template void eval_cache_store<N>(eval_cache_t *, const eval_request_t<N> *);
+
+FOR_EACH_BOARD_SIZE(INSTANTIATE_EVAL_CACHE)
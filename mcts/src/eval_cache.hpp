@@ -0,0 +1,43 @@
+#ifndef EVAL_CACHE_H_
+#define EVAL_CACHE_H_
+
+#include "ai_model.hpp"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/* a cached evaluation, stored in the canonical orientation of its position:
+the value and the prior of each canonical move, sorted by move */
+typedef struct {
+    uint64_t key; // canonical Zobrist hash of the position
+    float val;
+    std::vector<move_t> moves; // empty if the slot is unused
+    std::vector<float> ps;
+} eval_cache_entry_t;
+
+/* bounded table of network evaluations keyed by position, safe to share
+between threads. Positions are keyed by their canonical orientation, so an
+evaluation is reused by all 8 symmetric positions. It is direct-mapped: a new entry replaces whatever was in
+its slot, so the memory stays fixed once every slot has been filled. */
+typedef struct eval_cache_t {
+    std::vector<eval_cache_entry_t> entries; // power of two size
+    std::vector<std::mutex> locks; // each guards the slots congruent to it
+    std::atomic<long> hits;
+    std::atomic<long> misses;
+} eval_cache_t;
+
+/* capacity is rounded up to a power of two */
+eval_cache_t *new_eval_cache(size_t capacity);
+
+void free_eval_cache(eval_cache_t *cache);
+
+/* fill in the value and priors of a request if its position is cached. A
+cache should only hold positions of one board size, since the keys of
+different sizes may collide. */
+template <int N>
+bool eval_cache_lookup(eval_cache_t *cache, eval_request_t<N> *req);
+
+template <int N>
+void eval_cache_store(eval_cache_t *cache, const eval_request_t<N> *req);
+
+#endif // define EVAL_CACHE_H_
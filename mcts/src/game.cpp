@@ -7,172 +7,696 @@
 #include <cstring>
 #include <cassert>
 
-#define WALL_OFFSET 10
+/* directions for tower moves, in the order of the policy head */
+static constexpr int DIS[4] = {1,-1,0,0};
+static constexpr int DJS[4] = {0,0,1,-1};
 
-/* helper functions to get tower heights */
+template <int N>
+static inline int popcount(bitboard_t<N> b) {
+    return __builtin_popcountll(b);
+}
 
-int get_tower_height(tak_game_t *game, uint8_t i, uint8_t j) {
-    int h = 0;
-    while (game->board[i][j][h] != 0 && h < 8) {
-        h++;
+/* squares reached by moving 1 to N - 1 steps from each square in each
+direction, so that tower moves do not have to bounds check every step */
+template <int N>
+struct ray_table_t {
+    uint8_t len[N * N][4];
+    uint8_t sq[N * N][4][N - 1];
+};
+
+template <int N>
+static constexpr ray_table_t<N> make_rays() {
+    ray_table_t<N> rays = {};
+    for (int sq = 0; sq < N * N; sq++) {
+        for (int k = 0; k < 4; k++) {
+            int i = sq / N + DIS[k];
+            int j = sq % N + DJS[k];
+            while (i >= 0 && i < N && j >= 0 && j < N) {
+                rays.sq[sq][k][rays.len[sq][k]++] = i * N + j;
+                i += DIS[k];
+                j += DJS[k];
+            }
+        }
     }
-    return h;
+    return rays;
 }
 
-int tallest_tower(tak_game_t *game) {
-    int max = 0;
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            while (max < 8 && game->board[i][j][max] != 0) {
-                max++;
+template <int N>
+static constexpr ray_table_t<N> RAYS = make_rays<N>();
+
+/* Zobrist keys for walls, capstones and the turn. Stacks have too many
+layouts for a table of keys, so a square's stack hashes to a mix of the
+packed stack and a key of the square instead, a 64-bit half at a time.
+Empty squares hash to 0, as does the starting position. The pieces left in
+reserve are not hashed since they follow from the pieces on the board. */
+template <int N>
+struct zobrist_table_t {
+    uint64_t stack[N * N][2];
+    uint64_t wall[N * N];
+    uint64_t turn;
+    uint64_t cap[N * N];
+};
+
+/* the splitmix64 finalizer, which spreads every input bit over the output */
+static constexpr uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static constexpr uint64_t splitmix64(uint64_t &state) {
+    return mix64(state += 0x9E3779B97F4A7C15ULL);
+}
+
+template <int N>
+static constexpr zobrist_table_t<N> make_zobrist() {
+    zobrist_table_t<N> keys = {};
+    uint64_t state = 0x7A4B;
+    for (int sq = 0; sq < N * N; sq++) {
+        keys.stack[sq][0] = splitmix64(state);
+        keys.stack[sq][1] = splitmix64(state);
+        keys.wall[sq] = splitmix64(state);
+    }
+    keys.turn = splitmix64(state);
+    for (int sq = 0; sq < N * N; sq++) {
+        keys.cap[sq] = splitmix64(state);
+    }
+    return keys;
+}
+
+template <int N>
+static constexpr zobrist_table_t<N> ZOBRIST = make_zobrist<N>();
+
+/* hash of a stack, and a wall or capstone on top of it, placed on square sq;
+the two parts are kept apart so that tower moves can update them separately */
+template <int N>
+static inline uint64_t pieces_hash(int sq, stack_word_t<N> stack) {
+    if (stack == 0) {
+        return 0;
+    }
+    uint64_t hash = mix64((uint64_t) stack ^ ZOBRIST<N>.stack[sq][0]);
+    if constexpr (sizeof(stack_word_t<N>) > 8) {
+        hash ^= mix64((uint64_t) (stack >> 64) ^ ZOBRIST<N>.stack[sq][1]);
+    }
+    return hash;
+}
+
+template <int N>
+static inline uint64_t top_hash(int sq, bool wall, bool cap) {
+    uint64_t hash = 0;
+    if (wall) {
+        hash ^= ZOBRIST<N>.wall[sq];
+    }
+    if (cap) {
+        hash ^= ZOBRIST<N>.cap[sq];
+    }
+    return hash;
+}
+
+template <int N>
+static inline uint64_t stack_hash(int sq, stack_word_t<N> stack, bool wall, bool cap) {
+    return pieces_hash<N>(sq, stack) ^ top_hash<N>(sq, wall, cap);
+}
+
+template <int N>
+static inline uint64_t square_hash(const tak_game_t<N> *game, int sq) {
+    return stack_hash<N>(sq, game->stacks[sq], (game->walls >> sq) & 1, (game->caps >> sq) & 1);
+}
+
+template <int N>
+uint64_t game_hash(const tak_game_t<N> *game) {
+    uint64_t hash = game->turn == 2 ? ZOBRIST<N>.turn : 0;
+    for (int sq = 0; sq < N * N; sq++) {
+        hash ^= square_hash(game, sq);
+    }
+    return hash;
+}
+
+/* the 8 symmetries of the board: bit 2 transposes the board, then bits 0 and
+1 reflect the rows and the columns */
+template <int N>
+struct symmetry_table_t {
+    uint8_t sq[N_SYMMETRIES][N * N]; // image of each square
+    uint8_t dir[N_SYMMETRIES][4]; // image of each tower move direction
+    /* image of each (square, move type) part of a packed move; the drops
+    are the same in every orientation */
+    uint16_t move[N_SYMMETRIES][N * N * POLICY_TYPES<N>];
+};
+
+template <int N>
+static constexpr symmetry_table_t<N> make_symmetries() {
+    symmetry_table_t<N> syms = {};
+    for (int s = 0; s < N_SYMMETRIES; s++) {
+        for (int sq = 0; sq < N * N; sq++) {
+            int i = sq / N;
+            int j = sq % N;
+            if (s & 4) {
+                int t = i; i = j; j = t;
+            }
+            if (s & 1) {
+                i = N - 1 - i;
+            }
+            if (s & 2) {
+                j = N - 1 - j;
+            }
+            syms.sq[s][sq] = i * N + j;
+        }
+        for (int k = 0; k < 4; k++) {
+            int di = DIS[k];
+            int dj = DJS[k];
+            if (s & 4) {
+                int t = di; di = dj; dj = t;
             }
+            if (s & 1) {
+                di = -di;
+            }
+            if (s & 2) {
+                dj = -dj;
+            }
+            for (int k2 = 0; k2 < 4; k2++) {
+                if (DIS[k2] == di && DJS[k2] == dj) {
+                    syms.dir[s][k] = k2;
+                }
+            }
+        }
+        for (int sq = 0; sq < N * N; sq++) {
+            for (int type = 0; type < POLICY_TYPES<N>; type++) {
+                int type2 = type < 2 || type >= 6 ? type : 2 + syms.dir[s][type - 2];
+                syms.move[s][sq * POLICY_TYPES<N> + type] = syms.sq[s][sq] * POLICY_TYPES<N> + type2;
+            }
+        }
+    }
+    return syms;
+}
+
+template <int N>
+static constexpr symmetry_table_t<N> SYMMETRIES = make_symmetries<N>();
+
+template <int N>
+move_t transform_move(move_t move, int sym) {
+    int part = move / POLICY_DROPS<N>;
+    return SYMMETRIES<N>.move[sym][part] * POLICY_DROPS<N> + move % POLICY_DROPS<N>;
+}
+
+template <int N>
+int canonical_symmetry(const tak_game_t<N> *game, uint64_t *hash) {
+    uint64_t turn = game->turn == 2 ? ZOBRIST<N>.turn : 0;
+    uint64_t hashes[N_SYMMETRIES];
+    std::fill_n(hashes, N_SYMMETRIES, turn);
+    for (int sq = 0; sq < N * N; sq++) {
+        stack_word_t<N> stack = game->stacks[sq];
+        if (stack == 0) {
+            continue; // empty squares hash to 0 wherever they land
         }
+        bool wall = (game->walls >> sq) & 1;
+        bool cap = (game->caps >> sq) & 1;
+        for (int s = 0; s < N_SYMMETRIES; s++) {
+            hashes[s] ^= stack_hash<N>(SYMMETRIES<N>.sq[s][sq], stack, wall, cap);
+        }
+    }
+
+    int best = 0;
+    for (int s = 1; s < N_SYMMETRIES; s++) {
+        if (hashes[s] < hashes[best]) {
+            best = s;
+        }
+    }
+    *hash = hashes[best];
+    return best;
+}
+
+/* helper functions to get tower heights */
+
+template <int N>
+int get_tower_height(tak_game_t<N> *game, uint8_t i, uint8_t j) {
+    return STACK_HEIGHT(game->stacks[i * N + j]);
+}
+
+template <int N>
+int tallest_tower(tak_game_t<N> *game) {
+    int max = 0;
+    for (int sq = 0; sq < N * N; sq++) {
+        max = std::max(max, STACK_HEIGHT(game->stacks[sq]));
     }
     return max;
 }
 
+template <int N>
+uint8_t get_piece(const tak_game_t<N> *game, uint8_t i, uint8_t j, int h) {
+    int sq = i * N + j;
+    stack_word_t<N> stack = game->stacks[sq];
+    if (h >= STACK_HEIGHT(stack)) {
+        return 0;
+    }
+    uint8_t piece = (uint8_t) ((stack >> h) & 1) + 1;
+    if (h == 0 && (game->walls >> sq) & 1) {
+        piece += WALL_OFFSET;
+    }
+    if (h == 0 && (game->caps >> sq) & 1) {
+        piece += CAP_OFFSET;
+    }
+    return piece;
+}
+
+template <int N>
+void game_to_board(const tak_game_t<N> *game, uint8_t board[N][N][BOARD_DEPTH]) {
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) {
+            for (int h = 0; h < BOARD_DEPTH; h++) {
+                board[i][j][h] = get_piece(game, i, j, h);
+            }
+        }
+    }
+}
+
 /* methods to mutate board state */
-void add_piece(tak_game_t *game, uint8_t i, uint8_t j, int piece) {
-    memmove(&game->board[i][j][1], &game->board[i][j][0], 7);
-    game->board[i][j][0] = piece;
+
+/* recompute the top-owner bitboards for a square from its stack */
+template <int N>
+static inline void update_top(tak_game_t<N> *game, int sq) {
+    stack_word_t<N> stack = game->stacks[sq];
+    bitboard_t<N> bit = (bitboard_t<N>) 1 << sq;
+    game->top[0] &= ~bit;
+    game->top[1] &= ~bit;
+    if (STACK_HEIGHT(stack) > 0) {
+        game->top[(int) (stack & 1)] |= bit;
+    }
 }
 
-void move_tower(tak_game_t *game, uint8_t i, uint8_t j, uint8_t di, uint8_t dj, uint8_t drop0, uint8_t drop1, uint8_t drop2) {
-    uint8_t drop3 = get_tower_height(game, i, j) - drop0 - drop1 - drop2;
-    uint8_t drops[3] = {drop1, drop2, drop3};
+/* push `n` pieces (given by their owner bits, top first) onto a stack; the
+height marker moves up with the pieces below, and an empty square gets one */
+template <int N>
+static inline stack_word_t<N> push_pieces(stack_word_t<N> stack, stack_word_t<N> owners, int n) {
+    return ((stack | (stack == 0)) << n) | owners;
+}
 
-    for (int c = 1; c <= 3; c++) {
-        uint8_t i_dst = i + c * di;
-        uint8_t j_dst = j + c * dj;
-        uint8_t drop = drops[c - 1];
-        
-        if (i_dst < 0 || i_dst >= 4 || j_dst < 0 || j_dst >= 4 || drop == 0) {
-            continue;
+template <int N>
+void add_piece(tak_game_t<N> *game, uint8_t i, uint8_t j, int piece) {
+    int sq = i * N + j;
+    bitboard_t<N> bit = (bitboard_t<N>) 1 << sq;
+    int player = piece % WALL_OFFSET;
+    game->hash ^= square_hash(game, sq);
+    game->stacks[sq] = push_pieces<N>(game->stacks[sq], player - 1, 1);
+    update_top(game, sq);
+    game->walls &= ~bit;
+    game->caps &= ~bit;
+    if (piece > CAP_OFFSET) {
+        game->caps |= bit;
+    } else if (piece > WALL_OFFSET) {
+        game->walls |= bit;
+    }
+    game->hash ^= square_hash(game, sq);
+}
+
+/* move the tower on square `sq` in direction k, leaving drops[0] pieces
+behind and dropping drops[c] pieces c squares away. The carried pieces are
+dropped bottom first, so a wall or capstone on top lands with the last drop;
+a capstone landing there flattens any wall it covers. */
+template <int N>
+void move_tower(tak_game_t<N> *game, int sq, int k, const uint8_t *drops) {
+    stack_word_t<N> src = game->stacks[sq];
+    int moved = STACK_HEIGHT(src) - drops[0];
+    int carried = moved;
+    int sq_last = sq;
+    for (int c = 1; c <= RAYS<N>.len[sq][k] && drops[c] > 0; c++) {
+        int drop = drops[c];
+        sq_last = RAYS<N>.sq[sq][k][c - 1];
+
+        // the bottom `drop` of the carried pieces, which are the top of the tower
+        carried -= drop;
+        stack_word_t<N> dropped = (src >> carried) & (((stack_word_t<N>) 1 << drop) - 1);
+        stack_word_t<N> dst = push_pieces<N>(game->stacks[sq_last], dropped, drop);
+        game->hash ^= pieces_hash<N>(sq_last, game->stacks[sq_last]) ^ pieces_hash<N>(sq_last, dst);
+        game->stacks[sq_last] = dst;
+        update_top(game, sq_last);
+    }
+    // the marker comes down with the pieces left behind, unless none are
+    stack_word_t<N> rest = drops[0] > 0 ? src >> moved : 0;
+    game->hash ^= pieces_hash<N>(sq, src) ^ pieces_hash<N>(sq, rest);
+    game->stacks[sq] = rest;
+    update_top(game, sq);
+
+    /* the squares passed over hold neither walls nor capstones, so only the
+    top of the source and of the last square change kind */
+    bitboard_t<N> bit_src = (bitboard_t<N>) 1 << sq;
+    bitboard_t<N> bit_last = (bitboard_t<N>) 1 << sq_last;
+    bool wall = game->walls & bit_src;
+    bool cap = game->caps & bit_src;
+    game->hash ^= top_hash<N>(sq, wall, cap) ^ top_hash<N>(sq_last, game->walls & bit_last, false);
+    game->hash ^= top_hash<N>(sq_last, wall, cap);
+    game->walls &= ~(bit_src | bit_last);
+    game->caps &= ~bit_src;
+    if (wall) {
+        game->walls |= bit_last;
+    }
+    if (cap) {
+        game->caps |= bit_last;
+    }
+}
+
+/* on the first turn, the first two pieces played, each player places a flat
+of the opponent's */
+template <int N>
+static inline bool first_turn(const tak_game_t<N> *game) {
+    int reserves = game->p1_pieces_rem + game->p2_pieces_rem + game->p1_caps_rem + game->p2_caps_rem;
+    return reserves > 2 * (PIECES<N> + CAPS<N>) - 2;
+}
+
+/* methods to check for available moves */
+
+/* the ways to split each tower, as listed by for_each_drop_pattern, for
+each height up to DROP_HEIGHT and each reach. flatten lists those among them
+that drop a lone capstone on the last square of the reach, as the patterns
+for a capstone moving onto a wall there. */
+template <int N>
+constexpr int max_drop_patterns() {
+    int most = 0;
+    for (int h = 1; h <= DROP_HEIGHT<N>; h++) {
+        int n = 0;
+        for_each_drop_pattern<N>(h, N - 1, [&](const uint8_t *, int) { n++; });
+        most = n > most ? n : most;
+    }
+    return most;
+}
+
+template <int N>
+struct drop_table_t {
+    static constexpr int MAX_PATTERNS = max_drop_patterns<N>();
+    uint8_t size[DROP_HEIGHT<N> + 1][N];
+    uint8_t drops[DROP_HEIGHT<N> + 1][N][MAX_PATTERNS][N];
+    uint16_t offset[DROP_HEIGHT<N> + 1][N][MAX_PATTERNS]; // drops part of the packed move
+    uint8_t flatten_size[DROP_HEIGHT<N> + 1][N];
+    uint8_t flatten[DROP_HEIGHT<N> + 1][N][MAX_PATTERNS]; // indices into drops[h][reach]
+};
+
+template <int N>
+static constexpr drop_table_t<N> make_drop_patterns() {
+    drop_table_t<N> table = {};
+    for (int h = 1; h <= DROP_HEIGHT<N>; h++) {
+        for (int reach = 1; reach < N; reach++) {
+            for_each_drop_pattern<N>(h, reach, [&](const uint8_t *drops, int code) {
+                int n = table.size[h][reach]++;
+                table.offset[h][reach][n] = code;
+                for (int c = 0; c < N; c++) {
+                    table.drops[h][reach][n][c] = drops[c];
+                }
+                if (drops[reach] == 1) {
+                    table.flatten[h][reach][table.flatten_size[h][reach]++] = n;
+                }
+            });
         }
+    }
+    return table;
+}
 
-        // move the current tower out of the way
-        memmove(&game->board[i_dst][j_dst][drop], &game->board[i_dst][j_dst][0], 8 - drop);
+template <int N>
+static constexpr drop_table_t<N> DROP_PATTERNS = make_drop_patterns<N>();
 
-        // move tower into position
-        memmove(&game->board[i_dst][j_dst][0], &game->board[i][j][0], drop);
+/* the drops of each code on boards where the policy head enumerates them;
+drops[0] holds the pieces carried */
+template <int N>
+struct drop_codes_t {
+    uint8_t drops[POLICY_DROPS<N>][N];
+};
 
-        // shift original tower into position
-        memmove(&game->board[i][j][0], &game->board[i][j][drop], 8 - drop);
+template <int N>
+static constexpr drop_codes_t<N> make_drop_codes() {
+    drop_codes_t<N> codes = {};
+    if constexpr (!LEGACY_DROPS<N>) {
+        for_each_drop_pattern<N>(CARRY<N>, N - 1, [&](const uint8_t *drops, int code) {
+            codes.drops[code][0] = CARRY<N> - drops[0];
+            for (int c = 1; c < N; c++) {
+                codes.drops[code][c] = drops[c];
+            }
+        });
     }
+    return codes;
 }
 
-void apply_move(tak_game_t *new_game, tak_game_t *old_game, move_t *move) {
-    memcpy(new_game, old_game, sizeof(tak_game_t));
+template <int N>
+static constexpr drop_codes_t<N> DROP_CODES = make_drop_codes<N>();
 
-    switch (move->move) {
-        case FLAT: 
-            add_piece(new_game, move->i, move->j, new_game->turn);
-            break;
+/* spell out the drops part of a packed tower move from a tower of height h;
+see LEGACY_DROPS for the two layouts */
+template <int N>
+static inline void decode_drops(int code, int h, uint8_t drops[N]) {
+    if constexpr (LEGACY_DROPS<N>) {
+        int rest = h;
+        for (int c = 0; c < N - 1; c++) {
+            drops[c] = (code / ipow(8, N - 2 - c)) % 8;
+            rest -= drops[c];
+        }
+        // d0 counts a tower as at most LEGACY_TOWER tall
+        int taller = std::max(h - LEGACY_TOWER, 0);
+        drops[0] += taller;
+        drops[N - 1] = rest - taller;
+    } else {
+        drops[0] = h - DROP_CODES<N>.drops[code][0];
+        for (int c = 1; c < N; c++) {
+            drops[c] = DROP_CODES<N>.drops[code][c];
+        }
+    }
+}
+
+/* methods to convert between packed and unpacked moves */
+
+template <int N>
+bool pack_move(move_info_t info, move_t *move) {
+    int sq = info.i * N + info.j;
+    int type;
+    switch (info.move) {
+        case FLAT:
+            *move = sq * POLICY_TYPES<N> * POLICY_DROPS<N>;
+            return true;
         case WALL:
-            add_piece(new_game, move->i, move->j, new_game->turn + WALL_OFFSET);
-            break;
+            *move = (sq * POLICY_TYPES<N> + 1) * POLICY_DROPS<N>;
+            return true;
+        case CAP:
+            // without capstones there is no such move type
+            *move = (sq * POLICY_TYPES<N> + 6) * POLICY_DROPS<N>;
+            return CAPS<N> > 0;
         case MOVE:
-            move_tower(new_game, move->i, move->j, move->di, move->dj, move->drop0, move->drop1, move->drop2);
+        default:
+            type = 2;
+            if (info.di == -1) {type = 3;}
+            if (info.dj == 1) {type = 4;}
+            if (info.dj == -1) {type = 5;}
+            int code = 0;
+            if constexpr (LEGACY_DROPS<N>) {
+                for (int c = 0; c < N - 1; c++) {
+                    if (info.drops[c] > 7) {
+                        return false;
+                    }
+                    code = code * 8 + info.drops[c];
+                }
+            } else {
+                int carried = 0;
+                for (int c = 1; c < N; c++) {
+                    carried += info.drops[c];
+                }
+                // the drops must be one of the patterns a tower move can make
+                for (code = 0; code < POLICY_DROPS<N>; code++) {
+                    const uint8_t *drops = DROP_CODES<N>.drops[code];
+                    if (drops[0] == carried && std::equal(drops + 1, drops + N, info.drops + 1)) {
+                        break;
+                    }
+                }
+                if (code == POLICY_DROPS<N>) {
+                    return false;
+                }
+            }
+            *move = (sq * POLICY_TYPES<N> + type) * POLICY_DROPS<N> + code;
+            return true;
     }
-    if (move->move != MOVE) {
-        if (new_game->turn == 1) {
-            new_game->p1_pieces_rem--;
-        } else {
-            new_game->p2_pieces_rem--;
+}
+
+template <int N>
+move_info_t unpack_move(move_t move) {
+    int code = move % POLICY_DROPS<N>;
+    int type = (move / POLICY_DROPS<N>) % POLICY_TYPES<N>;
+    int sq = move / (POLICY_DROPS<N> * POLICY_TYPES<N>);
+    move_info_t info = {MOVE, (uint8_t) (sq / N), (uint8_t) (sq % N), 0, 0, {}};
+    switch (type) {
+        case 0:
+            info.move = FLAT;
+            break;
+        case 1:
+            info.move = WALL;
+            break;
+        case 6:
+            info.move = CAP;
+            break;
+        default:
+            info.di = DIS[type - 2];
+            info.dj = DJS[type - 2];
+            if constexpr (LEGACY_DROPS<N>) {
+                for (int c = 0; c < N - 1; c++) {
+                    info.drops[c] = (code / ipow(8, N - 2 - c)) % 8;
+                }
+            } else {
+                std::copy_n(DROP_CODES<N>.drops[code] + 1, N - 1, info.drops + 1);
+            }
+    }
+    return info;
+}
+
+/* play a move on a game in place */
+template <int N>
+static inline void play_move(tak_game_t<N> *game, move_t move) {
+    int code = move % POLICY_DROPS<N>;
+    int type = (move / POLICY_DROPS<N>) % POLICY_TYPES<N>;
+    int sq = move / (POLICY_DROPS<N> * POLICY_TYPES<N>);
+    uint8_t drops[N];
+    int player = game->turn;
+    switch (type) {
+        case 0:
+            if (first_turn(game)) {
+                player = 3 - player;
+            }
+            add_piece(game, sq / N, sq % N, player);
+            (player == 1 ? game->p1_pieces_rem : game->p2_pieces_rem)--;
+            break;
+        case 1:
+            add_piece(game, sq / N, sq % N, player + WALL_OFFSET);
+            (player == 1 ? game->p1_pieces_rem : game->p2_pieces_rem)--;
+            break;
+        case 6:
+            add_piece(game, sq / N, sq % N, player + CAP_OFFSET);
+            (player == 1 ? game->p1_caps_rem : game->p2_caps_rem)--;
+            break;
+        default:
+            decode_drops<N>(code, STACK_HEIGHT(game->stacks[sq]), drops);
+            move_tower(game, sq, type - 2, drops);
+    }
+    game->turn = (game->turn % 2) + 1;
+    game->hash ^= ZOBRIST<N>.turn;
+}
+
+template <int N>
+void apply_move(tak_game_t<N> *new_game, tak_game_t<N> *old_game, move_t move) {
+    memcpy(new_game, old_game, sizeof(tak_game_t<N>));
+    play_move(new_game, move);
+}
+
+template <int N>
+void make_move(tak_game_t<N> *game, move_t move, undo_t<N> *undo) {
+    int type = (move / POLICY_DROPS<N>) % POLICY_TYPES<N>;
+    int sq = move / (POLICY_DROPS<N> * POLICY_TYPES<N>);
+    undo->hash = game->hash;
+    undo->top[0] = game->top[0];
+    undo->top[1] = game->top[1];
+    undo->walls = game->walls;
+    undo->caps = game->caps;
+    undo->stacks[0] = game->stacks[sq];
+    if (type >= 2 && type < 6) {
+        for (int c = 0; c < RAYS<N>.len[sq][type - 2]; c++) {
+            undo->stacks[c + 1] = game->stacks[RAYS<N>.sq[sq][type - 2][c]];
         }
     }
-    new_game->turn = (new_game->turn % 2) + 1;
+    play_move(game, move);
 }
 
-/* methods to check for available moves */
+template <int N>
+void unmake_move(tak_game_t<N> *game, move_t move, const undo_t<N> *undo) {
+    int type = (move / POLICY_DROPS<N>) % POLICY_TYPES<N>;
+    int sq = move / (POLICY_DROPS<N> * POLICY_TYPES<N>);
+    if (type >= 2 && type < 6) {
+        for (int c = 0; c < RAYS<N>.len[sq][type - 2]; c++) {
+            game->stacks[RAYS<N>.sq[sq][type - 2][c]] = undo->stacks[c + 1];
+        }
+    } else {
+        // the piece placed is on top, and on the first turn it is the opponent's
+        bool p2 = game->stacks[sq] & 1;
+        if (type == 6) {
+            (p2 ? game->p2_caps_rem : game->p1_caps_rem)++;
+        } else {
+            (p2 ? game->p2_pieces_rem : game->p1_pieces_rem)++;
+        }
+    }
+    game->stacks[sq] = undo->stacks[0];
+    game->top[0] = undo->top[0];
+    game->top[1] = undo->top[1];
+    game->walls = undo->walls;
+    game->caps = undo->caps;
+    game->hash = undo->hash;
+    game->turn = (game->turn % 2) + 1;
+}
 
 /* helper function to handle movement of towers */
-void search_line(
-    tak_game_t *game, uint8_t i, uint8_t j, 
-    int tower_height, std::vector<move_t> &moves
+template <int N>
+static inline void search_line(
+    tak_game_t<N> *game, int src, int tower_height, bool cap, move_list_t<N> *moves
 ) {
-    int dis[4] = {1,-1,0,0};
-    int djs[4] = {0,0,1,-1};
+    bitboard_t<N> blockers = game->walls | game->caps;
     for (int k = 0; k < 4; k++) {
-        int di = dis[k];
-        int dj = djs[k];
-    
-        int max_drops[4] = {0};
-        max_drops[0] = tower_height - 1;
+        move_t base = (src * POLICY_TYPES<N> + 2 + k) * POLICY_DROPS<N>;
+
+        // pieces cannot be dropped on or past a wall or capstone
+        int len = RAYS<N>.len[src][k];
+        int reach = 0;
+        while (reach < len && !((blockers >> RAYS<N>.sq[src][k][reach]) & 1)) {
+            reach++;
+        }
 
-        if (!(di == 0 ^ dj == 0)) {
+        int n_patterns = DROP_PATTERNS<N>.size[tower_height][reach];
+        for (int p = 0; p < n_patterns; p++) {
+            moves->moves[moves->size++] = base + DROP_PATTERNS<N>.offset[tower_height][reach][p];
+        }
+
+        // a capstone moving on its own flattens a wall at the end of the move
+        if (!cap || reach == len) {
             continue;
         }
-        bool hit_wall = false;
-        for (int k = 0; k < 3; k++) {
-            if (i + (k+1)*di < 0 || i + (k+1)*di >= 4
-                ||j + (k+1)*dj < 0 || j + (k+1)*dj >= 4) {
-                break;
-            }
-            int curr = game->board[i + (k+1)*di][j + (k+1)*dj][0];
-            if (curr >= WALL_OFFSET) {
-                hit_wall = true;
-            }
-            max_drops[k+1] = hit_wall ? 0 : std::max(0,tower_height - k);
+        int wall_sq = RAYS<N>.sq[src][k][reach];
+        if (!((game->walls >> wall_sq) & 1)) {
+            continue;
         }
-        for (uint8_t d0 = 0; d0 <= max_drops[0]; d0++) {
-            for (uint8_t d1 = 1; d1 <= max_drops[1]; d1++) {
-                for (uint8_t d2 = 0; d2 <= max_drops[2]; d2++) {
-                    if (d0 + d1 + d2 > tower_height || d0 + d1 + d2 + max_drops[3] < tower_height) {
-                        continue;
-                    }
-                    int d3 = tower_height - d0 - d1 - d2;
-                    if ((d0 + get_tower_height(game, i, j) < 8) 
-                     && (d1 == 0 || d1 + get_tower_height(game, i + di, j + dj) < 8)
-                     && (d2 == 0 || d2 + get_tower_height(game, i + 2*di, j + 2*dj) < 8)
-                     && (d3 == 0 || d3 + get_tower_height(game, i + 3*di, j + 3*dj) < 8))
-                    {
-                        assert(game->board[i+di][j+dj][0] <= WALL_OFFSET);
-                        move_t m{MOVE, i, j, (int8_t) di, (int8_t) dj, d0, d1, d2};
-                        moves.push_back(m);
-                    }
-                }
-            }
+        reach++;
+        n_patterns = DROP_PATTERNS<N>.flatten_size[tower_height][reach];
+        for (int f = 0; f < n_patterns; f++) {
+            int p = DROP_PATTERNS<N>.flatten[tower_height][reach][f];
+            moves->moves[moves->size++] = base + DROP_PATTERNS<N>.offset[tower_height][reach][p];
         }
     }
 }
 
-std::vector<move_t> available_moves(tak_game_t *game) {
-    std::vector<move_t> moves;
-    for (uint8_t i = 0; i < 4; i++) {
-        for (uint8_t j = 0; j < 4; j++) {
-            if (game->board[i][j][0] == 0) {
-                // empty; 
-                // can place flat piece
-                move_t flat{FLAT,i,j,0,0,0,0};
-                moves.push_back(flat);
-                // can place wall here
-                move_t wall{WALL,i,j,0,0,0,0};
-                moves.push_back(wall);   
+template <int N>
+void available_moves(tak_game_t<N> *game, move_list_t<N> *moves) {
+    moves->size = 0;
+    bool opening = first_turn(game);
+    bitboard_t<N> empty = ~(game->top[0] | game->top[1]) & ALL_SQUARES<N>;
+    bitboard_t<N> own = opening ? 0 : game->top[game->turn - 1];
+    bool stones = (game->turn == 1 ? game->p1_pieces_rem : game->p2_pieces_rem) > 0;
+    bool caps = (game->turn == 1 ? game->p1_caps_rem : game->p2_caps_rem) > 0;
+
+    // visit empty and own squares in order
+    uint64_t squares = empty | own;
+    while (squares) {
+        int sq = __builtin_ctzll(squares);
+        squares &= squares - 1;
+        if ((empty >> sq) & 1) {
+            // only flats are placed on the first turn
+            if (stones || opening) {
+                moves->moves[moves->size++] = sq * POLICY_TYPES<N> * POLICY_DROPS<N>;
             }
-            if (game->board[i][j][0] == game->turn 
-                || game->board[i][j][0] == game->turn + WALL_OFFSET) {
-                int height = get_tower_height(game, i, j);
-                search_line(game, i, j, height, moves);
+            if (stones && !opening) {
+                moves->moves[moves->size++] = (sq * POLICY_TYPES<N> + 1) * POLICY_DROPS<N>;
             }
+            if (caps && !opening) {
+                moves->moves[moves->size++] = (sq * POLICY_TYPES<N> + 6) * POLICY_DROPS<N>;
+            }
+        } else {
+            int height = std::min(STACK_HEIGHT(game->stacks[sq]), DROP_HEIGHT<N>);
+            search_line(game, sq, height, (game->caps >> sq) & 1, moves);
         }
     }
-    return moves;
 }
 
 /* simple evaluation function based on the number of squares controlled by each player */
-float tiles_eval(tak_game_t *game) {
-    float p1_count = 0;
-    float p2_count = 0;
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            if (game->board[i][j][0] == 1 || game->board[i][j][0] == 1 + WALL_OFFSET) {
-                p1_count += 1;
-            } else if (game->board[i][j][0] == 2 || game->board[i][j][0] == 2 + WALL_OFFSET) {
-                p2_count += 1;
-            }
-        }
-    }
+template <int N>
+float tiles_eval(tak_game_t<N> *game) {
+    float p1_count = popcount<N>(game->top[0]);
+    float p2_count = popcount<N>(game->top[1]);
     if (p1_count + p2_count == 0) {
         return 0;
     }
@@ -184,158 +708,327 @@ float tiles_eval(tak_game_t *game) {
     }
 }
 
-/* check if two moves are equal */
-bool move_eq(move_t move1, move_t move2) {
-    bool first_part_eq = (move1.move == move2.move) 
-        && (move1.i == move2.i)
-        && (move1.j == move2.j);
-    if (move1.move == MOVE) {
-        bool second_part_eq = (move1.di == move2.di)
-        && (move1.dj == move2.dj)
-        && (move1.drop0 == move2.drop0)
-        && (move1.drop1 == move2.drop1)
-        && (move1.drop2 == move2.drop2);
-        return first_part_eq && second_part_eq;
+/* bitboard masks for the edges of the board */
+template <int N>
+static constexpr bitboard_t<N> edge_mask(bool row, int index) {
+    bitboard_t<N> mask = 0;
+    for (int k = 0; k < N; k++) {
+        mask |= (bitboard_t<N>) 1 << (row ? index * N + k : k * N + index);
     }
-    return first_part_eq;
+    return mask;
+}
+
+template <int N> static constexpr bitboard_t<N> EDGE_LEFT = edge_mask<N>(false, 0); // j == 0
+template <int N> static constexpr bitboard_t<N> EDGE_RIGHT = edge_mask<N>(false, N - 1); // j == N - 1
+template <int N> static constexpr bitboard_t<N> EDGE_TOP = edge_mask<N>(true, 0); // i == 0
+template <int N> static constexpr bitboard_t<N> EDGE_BOTTOM = edge_mask<N>(true, N - 1); // i == N - 1
+
+/* squares orthogonally adjacent to any square in the bitboard */
+template <int N>
+static inline bitboard_t<N> neighbours(bitboard_t<N> b) {
+    return (bitboard_t<N>) ((((b << 1) & ~EDGE_LEFT<N>) | ((b >> 1) & ~EDGE_RIGHT<N>) | (b << N) | (b >> N))
+        & ALL_SQUARES<N>);
+}
+
+/* grow `seed` through the squares of `mask` until it stops changing; paths
+can be long but roads are found in a few steps */
+template <int N>
+static inline bitboard_t<N> flood_fill(bitboard_t<N> seed, bitboard_t<N> mask) {
+    bitboard_t<N> prev;
+    seed &= mask;
+    do {
+        prev = seed;
+        seed |= neighbours<N>(seed) & mask;
+    } while (seed != prev);
+    return seed;
+}
+
+/* check if the squares in `flats` connect opposite edges of the board */
+template <int N>
+static inline bool has_road(bitboard_t<N> flats) {
+    return (flood_fill<N>(flats & EDGE_LEFT<N>, flats) & EDGE_RIGHT<N>)
+        || (flood_fill<N>(flats & EDGE_TOP<N>, flats) & EDGE_BOTTOM<N>);
 }
 
-/* find method for union-find datastructure */
-int find(int *uf, int a) {
-    if (uf[a] == -1) {
-        return a;
+template <int N>
+game_outcome_t game_outcome(tak_game_t<N> *game) {
+    /* check if a player has a "road" of flats and capstones across the board
+    by flood filling from one edge and checking if the opposite edge is
+    reached. A road needs at least N pieces, so most positions skip the fill.
+    If a move completes roads for both players, the player who made it wins. */
+    bitboard_t<N> roads[2] = {
+        (bitboard_t<N>) (game->top[0] & ~game->walls),
+        (bitboard_t<N>) (game->top[1] & ~game->walls),
+    };
+    bool p1_road = popcount<N>(roads[0]) >= N && has_road<N>(roads[0]);
+    bool p2_road = popcount<N>(roads[1]) >= N && has_road<N>(roads[1]);
+    if (p1_road && p2_road) {
+        return (game->turn == 1) ? P2_WIN : P1_WIN;
+    } else if (p1_road) {
+        return P1_WIN;
+    } else if (p2_road) {
+        return P2_WIN;
+    }
+
+    /* otherwise the game ends once a player has no pieces left to play or
+    the board is full, and the player with more flats on top wins */
+    bool out = game->p1_pieces_rem + game->p1_caps_rem == 0 || game->p2_pieces_rem + game->p2_caps_rem == 0;
+    if (!out && (game->top[0] | game->top[1]) != ALL_SQUARES<N>) {
+        return IN_PROGRESS;
+    }
+    int p1_count = popcount<N>(roads[0] & ~game->caps);
+    int p2_count = popcount<N>(roads[1] & ~game->caps);
+    if (p1_count > p2_count) {
+        return P1_WIN;
+    } else if (p2_count > p1_count) {
+        return P2_WIN;
     } else {
-        return find(uf, uf[a]);
-    }
-}
-
-/* 
-union method for union-find datastructure; also updates the direction array 
-*/
-void union_dir(int *uf, bool dirs[][16], int a, int b) {
-    a = find(uf, a);
-    b = find(uf, b);
-    if (a == b) {
-        return;
-    }
-    uf[b] = a;
-    dirs[0][a] = dirs[0][a] || dirs[0][b];
-    dirs[1][a] = dirs[1][a] || dirs[1][b];
-    dirs[2][a] = dirs[2][a] || dirs[2][b];
-    dirs[3][a] = dirs[3][a] || dirs[3][b];
-}
-
-game_outcome_t game_outcome(tak_game_t *game) {
-    /* first check if a player has no pieces left to play */
-    if (game->p1_pieces_rem == 0 || game->p2_pieces_rem == 0) {
-        int p1_count = 0;
-        int p2_count = 0;
-        for (int i = 0; i < 4; i++) {
-            for (int j = 0; j < 4; j++) {
-                switch (game->board[i][j][0]) {
-                    case 1:
-                        p1_count += 1;
-                        break;
-                    case 2:
-                        p2_count += 1;
-                        break;
-                }
+        return TIE;
+    }
+}
+
+/* create an empty game */
+template <int N>
+tak_game_t<N> new_tak_game() {
+    tak_game_t<N> g = {};
+    g.turn = 1;
+    g.p1_pieces_rem = PIECES<N>;
+    g.p2_pieces_rem = PIECES<N>;
+    g.p1_caps_rem = CAPS<N>;
+    g.p2_caps_rem = CAPS<N>;
+    g.hash = game_hash(&g);
+    return g;
+}
+
+/* TPS (Tak Positional System) notation: ranks from N down to 1 separated by
+'/', squares from file a separated by ',', each stack written bottom to top
+as the owners of its pieces with an S after a wall or a C after a capstone
+and runs of empty squares
+written as xN; then the player to move and the move number. The move number
+isn't tracked, so it is estimated from the pieces played and ignored when
+parsing. */
+template <int N>
+std::string game_to_tps(const tak_game_t<N> *game) {
+    std::ostringstream tps;
+    for (int j = N - 1; j >= 0; j--) {
+        int empty = 0;
+        for (int i = 0; i < N; i++) {
+            stack_word_t<N> stack = game->stacks[i * N + j];
+            if (STACK_HEIGHT(stack) == 0) {
+                empty++;
+                continue;
+            }
+            if (empty > 0) {
+                tps << "x" << (empty > 1 ? std::to_string(empty) : "") << ",";
+                empty = 0;
+            }
+            for (int k = STACK_HEIGHT(stack) - 1; k >= 0; k--) {
+                tps << (char) ('1' + (int) ((stack >> k) & 1));
+            }
+            if ((game->walls >> (i * N + j)) & 1) {
+                tps << "S";
+            }
+            if ((game->caps >> (i * N + j)) & 1) {
+                tps << "C";
             }
+            if (i < N - 1) {
+                tps << ",";
+            }
+        }
+        if (empty > 0) {
+            tps << "x" << (empty > 1 ? std::to_string(empty) : "");
         }
+        if (j > 0) {
+            tps << "/";
+        }
+    }
+    int played = 2 * (PIECES<N> + CAPS<N>) - game->p1_pieces_rem - game->p2_pieces_rem
+        - game->p1_caps_rem - game->p2_caps_rem;
+    tps << " " << (int) game->turn << " " << played / 2 + 1;
+    return tps.str();
+}
 
-        if (p1_count > p2_count) {
-            return P1_WIN;
-        } else if (p2_count > p1_count) {
-            return P2_WIN;
-        } else {
-            return TIE;
-        }
-    }
-
-    /* check if a player has a "road" across the board.
-    This uses a union-find data-structure to track which edges of the board
-    are reachable from a connected component. */
-    int uf[16];
-    std::fill_n(uf, 16, -1);
-    bool dirs[4][16] = {0};
-    
-    for (int i = 0; i < 4; i++) {
-        dirs[0][i*4+0] = true; // left
-        dirs[1][i*4+3] = true; // right
-        dirs[2][0*4+i] = true; // top
-        dirs[3][3*4+i] = true; // bottom
-    }
-
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            int dis[4] = {1,-1,0,0};
-            int djs[4] = {0,0,1,-1};
-            for (int k = 0; k < 4; k++) {
-                int di = dis[k];
-                int dj = djs[k];
-
-                int i_p = i + di;
-                int j_p = j + dj;
-                if (i_p < 0 || i_p >= 4 || j_p < 0 || j_p >= 4) {
-                    continue;
-                }
+template <int N>
+bool game_from_tps(const std::string &tps, tak_game_t<N> *game) {
+    std::istringstream fields(tps);
+    std::string board;
+    int turn = 1;
+    fields >> board;
+    if (!(fields >> turn)) {
+        turn = 1;
+    }
+    if (turn != 1 && turn != 2) {
+        return false;
+    }
 
-                if (game->board[i][j][0] == game->board[i_p][j_p][0] && (game->board[i][j][0] == 1 || game->board[i][j][0] == 2)) {
-                    int a = i * 4 + j;
-                    int b = i_p * 4 + j_p;
-                    union_dir(uf, dirs, a, b);
-                    
-                    int a_new = find(uf, a);
-                    if ((dirs[0][a_new] && dirs[1][a_new]) || (dirs[2][a_new] && dirs[3][a_new])) {
-                        if (game->board[i][j][0] == 1) {
-                            return P1_WIN;
-                        } else {
-                            return P2_WIN;
-                        }
+    *game = new_tak_game<N>();
+    game->turn = turn;
+    std::istringstream ranks(board);
+    std::string rank;
+    int j = N - 1;
+    while (std::getline(ranks, rank, '/')) {
+        if (j < 0) {
+            return false;
+        }
+        std::istringstream squares(rank);
+        std::string square;
+        int i = 0;
+        while (std::getline(squares, square, ',')) {
+            if (square.empty()) {
+                return false;
+            }
+            if (square[0] == 'x') {
+                int n = square.size() > 1 ? atoi(square.c_str() + 1) : 1;
+                if (n < 1) {
+                    return false;
+                }
+                i += n;
+                continue;
+            }
+            if (i >= N) {
+                return false;
+            }
+            int sq = i * N + j;
+            int len = (int) square.size();
+            for (int k = 0; k < len; k++) {
+                char c = square[k];
+                if (c == 'S' && k == len - 1 && k > 0) {
+                    game->walls |= (bitboard_t<N>) 1 << sq;
+                } else if (c == 'C' && k == len - 1 && k > 0) {
+                    game->caps |= (bitboard_t<N>) 1 << sq;
+                    (square[k - 1] == '1' ? game->p1_caps_rem : game->p2_caps_rem)--;
+                    (square[k - 1] == '1' ? game->p1_pieces_rem : game->p2_pieces_rem)++;
+                } else if ((c == '1' || c == '2') && k < 2 * (PIECES<N> + CAPS<N>)) {
+                    stack_word_t<N> stack = game->stacks[sq];
+                    game->stacks[sq] = push_pieces<N>(stack, c - '1', 1);
+                    if (c == '1') {
+                        game->p1_pieces_rem--;
+                    } else {
+                        game->p2_pieces_rem--;
                     }
+                } else {
+                    return false; // also rejects stacks taller than every piece
                 }
             }
+            update_top(game, sq);
+            i++;
+        }
+        if (i != N) {
+            return false;
         }
+        j--;
+    }
+    // pieces_rem wraps around if a player has more pieces than they start with
+    if (j != -1 || game->p1_pieces_rem > PIECES<N> || game->p2_pieces_rem > PIECES<N>
+            || game->p1_caps_rem > CAPS<N> || game->p2_caps_rem > CAPS<N>) {
+        return false;
+    }
+    game->hash = game_hash(game);
+    return true;
+}
+
+/* convert the game to a string for the TUI */
+template <int N>
+bool move_from_string(const std::string &str, tak_game_t<N> *game, move_t *move) {
+    if (str.size() < 3) {
+        return false;
+    }
+    move_info_t info = {};
+    switch (str[0]) {
+        case 'f':
+            info.move = FLAT;
+            break;
+        case 'w':
+            info.move = WALL;
+            break;
+        case 'c':
+            info.move = CAP;
+            break;
+        case 'm':
+            info.move = MOVE;
+            break;
+        default:
+            return false;
+    }
+    int i = str[1] - 'a';
+    int j = str[2] - '1';
+    if (!((0 <= i && i < N) && (0 <= j && j < N))) {
+        return false;
     }
+    info.i = i;
+    info.j = j;
 
-    /* if the board is full, check for winner by piece counts;
-    otherwise, the game is in progress */
-    int p1_count = 0;
-    int p2_count = 0;
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            switch (game->board[i][j][0]) {
-                case 1:
-                    p1_count += 1;
-                    break;
-                case 2:
-                    p2_count += 1;
-                    break;
-                case 0:
-                    return IN_PROGRESS;
+    if (info.move != MOVE) {
+        if (str.size() > 3) {
+            return false;
+        }
+    } else {
+        // a direction and at most the digits up to d(N-2)
+        if (str.size() < 4 || str.size() > 4 + N - 1) {
+            return false;
+        }
+        switch (str[3]) {
+            case 'w':
+                info.dj = -1;
+                break;
+            case 's':
+                info.dj = 1;
+                break;
+            case 'a':
+                info.di = -1;
+                break;
+            case 'd':
+                info.di = 1;
+                break;
+            default:
+                return false;
+        }
+
+        /* the digits given must fit in the tower, rather than be cut down to
+        a different move, and every square after the first takes a piece */
+        int h = get_tower_height(game, (uint8_t) i, (uint8_t) j);
+        int tot = 0;
+        for (int c = 0; c < N - 1; c++) {
+            int d;
+            if (4 + c < (int) str.size()) {
+                d = str[4 + c] - '0';
+                if (d < (c > 0 ? 1 : 0) || d > 9 || d > h - tot) {
+                    return false;
+                }
+            } else {
+                d = std::min(c > 0 ? 1 : 0, h - tot);
             }
+            info.drops[c] = d;
+            tot += d;
+        }
+        info.drops[N - 1] = h - tot;
+        if constexpr (LEGACY_DROPS<N>) {
+            // d0 counts the tower as at most LEGACY_TOWER tall
+            info.drops[0] -= std::min((int) info.drops[0], std::max(h - LEGACY_TOWER, 0));
         }
     }
 
-    return (p1_count > p2_count) ? P1_WIN : P2_WIN;
-}
-
-/* create an empty game */
-tak_game_t new_tak_game() {
-    tak_game_t g = {0};
-    g.turn = 1;
-    g.p1_pieces_rem = 15;
-    g.p2_pieces_rem = 15;
-    return g;
+    // tower moves carrying more than CARRY pieces have no packed move
+    if (!pack_move<N>(info, move)) {
+        return false;
+    }
+    move_list_t<N> moves;
+    available_moves(game, &moves);
+    for (int k = 0; k < moves.size; k++) {
+        if (move_eq(moves.moves[k], *move)) {
+            return true;
+        }
+    }
+    return false;
 }
 
-/* convert the game to a string for the TUI */
-std::string game_to_string(tak_game_t *game) {
+template <int N>
+std::string game_to_string(tak_game_t<N> *game) {
     int cell_height = std::max(tallest_tower(game), 1);
     int cell_width = 1;
     /* include extra row and column for coordinate labels*/
-    int width = 1 + (1 + cell_width) * 4 + 1 + 1; // last for newline
-    int height = 1 + (1 + cell_height) * 4 + 1;
+    int width = 1 + (1 + cell_width) * N + 1 + 1; // last for newline
+    int height = 1 + (1 + cell_height) * N + 1;
     std::vector<char> s(width * height,  ' ');
 
     for (int i = 1; i < height; i += (cell_height + 1)) {
@@ -345,13 +1038,13 @@ std::string game_to_string(tak_game_t *game) {
     }
 
     // coordinate labels
-    for (int i = 0; i < 4; i++) {
+    for (int i = 0; i < N; i++) {
         int s_i = 2 + (1 + cell_height) * i;
         int j_i = 0;
         s.at(s_i * width + j_i) = '1' + i;
     }
 
-    for (int j = 0; j < 4; j++) {
+    for (int j = 0; j < N; j++) {
         int s_i = 0;
         int j_i = 2 + 2 * j;
         s.at(s_i * width + j_i) = 'a' + j;
@@ -363,14 +1056,14 @@ std::string game_to_string(tak_game_t *game) {
         }
     }
 
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) {
             // print individual cell
             int s_i = 1+(1+cell_height) * j + cell_height;
             int s_j = 1+(1+cell_width) * i + 1;
             int t_height = get_tower_height(game, i, j);
             for (int di = 0; di < t_height; di++) {
-                uint8_t c = game->board[i][j][di];
+                uint8_t c = get_piece(game, i, j, di);
                 if (c != 0){
                     int idx = (s_i - t_height + di + 1) * width + s_j;
                     assert(s_j < width);
@@ -390,10 +1083,45 @@ std::string game_to_string(tak_game_t *game) {
             s.at(i) = 'A';
         } else if (s[i] == '0' + 2 + WALL_OFFSET) {
             s.at(i) = 'B';
+        } else if (s[i] == '0' + 1 + CAP_OFFSET) {
+            s.at(i) = 'C';
+        } else if (s[i] == '0' + 2 + CAP_OFFSET) {
+            s.at(i) = 'D';
         } else {
         }
     }
 
     std::string out(s.begin(), s.end());
     return out;
-}
\ No newline at end of file
+}
+
+bool check_board_size(int n) {
+    if (n < MIN_BOARD_SIZE || n > MAX_BOARD_SIZE) {
+        std::cerr << "board size must be from " << MIN_BOARD_SIZE << " to " << MAX_BOARD_SIZE << "\n";
+        return false;
+    }
+    return true;
+}
+
+#define INSTANTIATE_GAME(N) \
+    template uint64_t game_hash<N>(const tak_game_t<N> *); \
+    template move_t transform_move<N>(move_t, int); \
+    template int canonical_symmetry<N>(const tak_game_t<N> *, uint64_t *); \
+    template int get_tower_height<N>(tak_game_t<N> *, uint8_t, uint8_t); \
+    template uint8_t get_piece<N>(const tak_game_t<N> *, uint8_t, uint8_t, int); \
+    template void game_to_board<N>(const tak_game_t<N> *, uint8_t [N][N][BOARD_DEPTH]); \
+    template bool pack_move<N>(move_info_t, move_t *); \
+    template move_info_t unpack_move<N>(move_t); \
+    template void apply_move<N>(tak_game_t<N> *, tak_game_t<N> *, move_t); \
+    template void make_move<N>(tak_game_t<N> *, move_t, undo_t<N> *); \
+    template void unmake_move<N>(tak_game_t<N> *, move_t, const undo_t<N> *); \
+    template void available_moves<N>(tak_game_t<N> *, move_list_t<N> *); \
+    template float tiles_eval<N>(tak_game_t<N> *); \
+    template game_outcome_t game_outcome<N>(tak_game_t<N> *); \
+    template tak_game_t<N> new_tak_game<N>(); \
+    template std::string game_to_tps<N>(const tak_game_t<N> *); \
+    template bool game_from_tps<N>(const std::string &, tak_game_t<N> *); \
+    template bool move_from_string<N>(const std::string &, tak_game_t<N> *, move_t *); \
+    template std::string game_to_string<N>(tak_game_t<N> *);
+
+FOR_EACH_BOARD_SIZE(INSTANTIATE_GAME)
@@ -4,40 +4,310 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <type_traits>
 
-#define MAX_HEIGHT 8
+/* pieces of each stack, from the top, shown by board encodings: the
+byte-per-piece board and the network input */
+#define BOARD_DEPTH 9
+#define WALL_OFFSET 10
+#define CAP_OFFSET 20
 
-typedef struct {
-    uint8_t board[4][4][MAX_HEIGHT + 1]; // top is the 0th element
-    // use 1 and 2 to represent flat pieces of p1 and p2
-    // use 11 and 12 to represent wall pieces of p1 and p2
-    uint8_t p1_pieces_rem;
+/* the engine is templated on the board size N; every template is
+instantiated for each size from MIN_BOARD_SIZE to MAX_BOARD_SIZE, which
+FOR_EACH_BOARD_SIZE(X) expands X(N) for */
+#define MIN_BOARD_SIZE 3
+#define MAX_BOARD_SIZE 8
+#define FOR_EACH_BOARD_SIZE(X) X(3) X(4) X(5) X(6) X(7) X(8)
+
+/* call f(std::integral_constant<int, N>()) for the board size n, so that a
+size chosen at runtime picks the instantiation; returns false if there is
+none for n */
+template <typename F>
+bool with_board_size(int n, F &&f) {
+    switch (n) {
+#define BOARD_SIZE_CASE(N) case N: f(std::integral_constant<int, N>()); return true;
+        FOR_EACH_BOARD_SIZE(BOARD_SIZE_CASE)
+#undef BOARD_SIZE_CASE
+    }
+    return false;
+}
+
+/* whether there is an instantiation for board size n; if not, says so on
+stderr, for front ends to check a --size option */
+bool check_board_size(int n);
+
+/* one bit per square, indexed by i * N + j, in the smallest word that fits */
+template <int N>
+using bitboard_t = std::conditional_t<N * N <= 16, uint16_t,
+    std::conditional_t<N * N <= 32, uint32_t, uint64_t>>;
+
+template <int N>
+constexpr bitboard_t<N> ALL_SQUARES = (bitboard_t<N>) (~0ULL >> (64 - N * N));
+
+/* stones (flats or walls) and capstones each player starts with, by board
+size, as in standard Tak */
+constexpr int PIECES_BY_SIZE[MAX_BOARD_SIZE + 1] = {0, 0, 0, 10, 15, 21, 30, 40, 50};
+constexpr int CAPS_BY_SIZE[MAX_BOARD_SIZE + 1] = {0, 0, 0, 0, 0, 1, 1, 2, 2};
+
+template <int N>
+constexpr int PIECES = PIECES_BY_SIZE[N];
+
+template <int N>
+constexpr int CAPS = CAPS_BY_SIZE[N];
+
+/* stacks are packed into words wide enough for every piece of the game to
+be on one square: bit k is set if the k-th piece from the top belongs to p2,
+and the bit above the bottom piece is set to mark the height, so a stack h
+tall needs h + 1 bits. An empty square is 0. The words are copied with every
+game, so they are kept as narrow as the marker allows: 32 bits up to 4x4
+and 64 bits up to 6x6. */
+template <int N>
+constexpr int STACK_BITS = 2 * (PIECES<N> + CAPS<N>) + 1;
+
+template <int N>
+using stack_word_t = std::conditional_t<STACK_BITS<N> <= 32, uint32_t,
+    std::conditional_t<STACK_BITS<N> <= 64, uint64_t, unsigned __int128>>;
+
+static inline int stack_height(uint32_t stack) {
+    return 31 - __builtin_clz(stack | 1);
+}
+
+static inline int stack_height(uint64_t stack) {
+    return 63 - __builtin_clzll(stack | 1);
+}
+
+static inline int stack_height(unsigned __int128 stack) {
+    uint64_t high = (uint64_t) (stack >> 64);
+    return high ? 127 - __builtin_clzll(high) : stack_height((uint64_t) stack);
+}
+
+#define STACK_HEIGHT(s) stack_height(s)
+
+/* Games follow the standard rules: on the first turn each player places a
+flat of the opponent's; a tower move carries up to N pieces off the top of a
+stack, leaves the rest behind and drops one or more on each square it
+passes, the bottom pieces first; walls and capstones block moves, except
+that a capstone moving alone flattens a wall at the end of a move. */
+template <int N>
+constexpr int CARRY = N;
+
+/* Boards up to 4x4 keep the original policy head, which addresses the drops
+positionally as (d0, d1, ..., d(N-2)): the pieces left behind, then those
+dropped at each step, with the last drop implied. A digit only goes up to 7,
+so d0 counts the pieces left behind as if the tower were at most
+LEGACY_TOWER tall. That layout grows as 8^(N-2), so on larger boards the
+policy head enumerates the (carried, drops) patterns instead and the pieces
+left behind are implied. */
+template <int N>
+constexpr bool LEGACY_DROPS = N <= 4;
+
+#define LEGACY_TOWER 7
+
+/* the ways to split a tower stop depending on its height once it is as tall
+as the most pieces a move can carry, or on boards up to 4x4 as LEGACY_TOWER,
+so the drop patterns are listed for towers up to DROP_HEIGHT tall and taller
+towers share the patterns of a DROP_HEIGHT tower */
+template <int N>
+constexpr int DROP_HEIGHT = LEGACY_DROPS<N> ? LEGACY_TOWER : CARRY<N>;
+
+template <int N>
+struct tak_game_t {
+    bitboard_t<N> top[2]; // squares whose top piece belongs to p1 / p2
+    bitboard_t<N> walls; // squares whose top piece is a wall
+    bitboard_t<N> caps; // squares whose top piece is a capstone
+    stack_word_t<N> stacks[N * N]; // packed stack for each square
+    uint8_t p1_pieces_rem; // stones in reserve
     uint8_t p2_pieces_rem;
+    uint8_t p1_caps_rem; // capstones in reserve
+    uint8_t p2_caps_rem;
     uint8_t turn; // 1 or 2
-} tak_game_t;
+    uint64_t hash; // Zobrist hash, kept up to date by apply_move and make_move
+};
 
 typedef enum {
     MOVE,
     FLAT,
-    WALL
+    WALL,
+    CAP
 } move_option_t;
 
+/* a move spelled out; drops[0] is the pieces a tower move leaves behind and
+drops[k] the pieces dropped k squares away. A packed move doesn't hold the
+height of its tower, so unpack_move leaves what follows from it as 0: the
+last drop on boards up to 4x4 and the pieces left behind on larger boards.
+On boards up to 4x4 drops[0] is the d0 digit of LEGACY_DROPS, which is short
+of the pieces left behind by how much the tower is taller than LEGACY_TOWER.
+A FLAT is the opponent's piece on the first turn. */
 typedef struct {
     move_option_t move;
     uint8_t i;
     uint8_t j;
     int8_t di;
     int8_t dj;
-    uint8_t drop0;
-    uint8_t drop1;
-    uint8_t drop2;
-} move_t;
+    uint8_t drops[MAX_BOARD_SIZE];
+} move_info_t;
+
+/* moves are packed into their index in the flattened
+[N][N][POLICY_TYPES][POLICY_DROPS] policy head: square (i, j), move type
+(flat, wall, tower moves towards +i, -i, +j, -j, then capstone on boards
+with capstones) and the drops. Unused fields are 0, so every move has
+exactly one encoding and moves can be compared and hashed as integers. */
+typedef uint32_t move_t;
+
+template <int N>
+constexpr int POLICY_TYPES = CAPS<N> > 0 ? 7 : 6;
+
+constexpr int ipow(int base, int exp) {
+    return exp == 0 ? 1 : base * ipow(base, exp - 1);
+}
 
-std::vector<move_t> available_moves(tak_game_t *game);
+/* ways to carry up to `carry` pieces and drop at least one on each of up to
+`reach` squares */
+constexpr int count_drop_codes(int carry, int reach) {
+    int n = 0;
+    for (int c = 1; c <= carry; c++) {
+        for (int mask = 0; mask < (1 << (c - 1)); mask++) {
+            n += __builtin_popcount(mask) + 1 <= reach;
+        }
+    }
+    return n;
+}
 
-void apply_move(tak_game_t *new_game, tak_game_t *old_game, move_t *move);
+template <int N>
+constexpr int POLICY_DROPS = LEGACY_DROPS<N> ? 7 * ipow(8, N - 2) : count_drop_codes(CARRY<N>, N - 1);
 
-std::string game_to_string(tak_game_t *game);
+template <int N>
+constexpr int POLICY_SIZE = N * N * POLICY_TYPES<N> * POLICY_DROPS<N>;
+
+/* call f(drops, code) for each way to split a tower of height h moved up to
+`reach` squares before a wall, a capstone or the edge of the board, in the
+order moves are generated. drops has N entries as in move_info_t, and code
+is the drops part of the packed move. h is at most DROP_HEIGHT, which a
+taller tower stands in for. */
+template <int N, typename F>
+constexpr void for_each_drop_pattern(int h, int reach, F &&f) {
+    uint8_t drops[N] = {};
+    // every (carried, drops) pattern has a code; the mask marks where a drop ends
+    int code = -1;
+    for (int c = 1; c <= CARRY<N>; c++) {
+        for (int mask = 0; mask < (1 << (c - 1)); mask++) {
+            int n_drops = __builtin_popcount(mask) + 1;
+            if (n_drops >= N) {
+                continue; // the drops would run off the board
+            }
+            code++;
+            if (c > h || n_drops > reach) {
+                continue;
+            }
+            drops[0] = h - c;
+            int k = 1;
+            drops[1] = 1;
+            for (int b = 0; b < c - 1; b++) {
+                if ((mask >> b) & 1) {
+                    drops[++k] = 1;
+                } else {
+                    drops[k]++;
+                }
+            }
+            for (k++; k < N; k++) {
+                drops[k] = 0;
+            }
+            if constexpr (LEGACY_DROPS<N>) {
+                int positional = 0;
+                for (int d = 0; d < N - 1; d++) {
+                    positional = positional * 8 + drops[d];
+                }
+                f(drops, positional);
+            } else {
+                f(drops, code);
+            }
+        }
+    }
+}
+
+/* upper bound on the number of legal moves in any position: each square is
+either empty, with a placement of each kind, or holds a tower with as many
+moves as its height allows in each direction, and the towers hold at most
+every piece. A tower taller than DROP_HEIGHT has no more moves than one
+DROP_HEIGHT tall, so only towers up to that height are counted. Flattening a
+wall only adds moves that would be legal if the wall weren't there. */
+template <int N>
+constexpr int max_moves() {
+    int patterns[DROP_HEIGHT<N> + 1][N] = {};
+    for (int h = 1; h <= DROP_HEIGHT<N>; h++) {
+        for (int reach = 1; reach < N; reach++) {
+            for_each_drop_pattern<N>(h, reach, [&](const uint8_t *, int) { patterns[h][reach]++; });
+        }
+    }
+    // most[p]: most moves from the squares so far, with p pieces on them
+    constexpr int pieces = 2 * (PIECES<N> + CAPS<N>);
+    constexpr int placements = CAPS<N> > 0 ? 3 : 2;
+    int most[pieces + 1] = {};
+    for (int sq = 0; sq < N * N; sq++) {
+        int i = sq / N;
+        int j = sq % N;
+        int next[pieces + 1] = {};
+        for (int p = 0; p <= pieces; p++) {
+            next[p] = most[p] + placements;
+            for (int h = 1; h <= DROP_HEIGHT<N> && h <= p; h++) {
+                int moves = patterns[h][N - 1 - i] + patterns[h][i] + patterns[h][N - 1 - j] + patterns[h][j];
+                next[p] = most[p - h] + moves > next[p] ? most[p - h] + moves : next[p];
+            }
+        }
+        for (int p = 0; p <= pieces; p++) {
+            most[p] = next[p];
+        }
+    }
+    return most[pieces];
+}
+
+template <int N>
+constexpr int MAX_MOVES = max_moves<N>();
+
+/* pack a spelled-out move; false if no packed move has those fields, such
+as a tower move that carries more than CARRY pieces or drops in a pattern
+the policy head doesn't list */
+template <int N>
+bool pack_move(move_info_t info, move_t *move);
+
+template <int N>
+move_info_t unpack_move(move_t move);
+
+/* fixed-capacity move list, meant to live on the stack */
+template <int N>
+struct move_list_t {
+    move_t moves[MAX_MOVES<N>];
+    int size;
+};
+
+template <int N>
+void available_moves(tak_game_t<N> *game, move_list_t<N> *moves);
+
+template <int N>
+void apply_move(tak_game_t<N> *new_game, tak_game_t<N> *old_game, move_t move);
+
+/* what make_move overwrites, for unmake_move to put back: the hash, the
+bitboards and the stacks the move touches. The reserves and the turn follow
+from the move itself. */
+template <int N>
+struct undo_t {
+    uint64_t hash;
+    bitboard_t<N> top[2];
+    bitboard_t<N> walls;
+    bitboard_t<N> caps;
+    stack_word_t<N> stacks[N]; // the move's square, then those in a tower move's direction
+};
+
+/* play a move in place, saving in undo what unmake_move needs to take it
+back; moves must be unmade in the reverse order they were made */
+template <int N>
+void make_move(tak_game_t<N> *game, move_t move, undo_t<N> *undo);
+
+template <int N>
+void unmake_move(tak_game_t<N> *game, move_t move, const undo_t<N> *undo);
+
+template <int N>
+std::string game_to_string(tak_game_t<N> *game);
 
 typedef enum {
     IN_PROGRESS,
@@ -46,14 +316,67 @@ typedef enum {
     TIE
 } game_outcome_t;
 
-game_outcome_t game_outcome(tak_game_t *game);
+template <int N>
+game_outcome_t game_outcome(tak_game_t<N> *game);
+
+template <int N>
+float tiles_eval(tak_game_t<N> *game);
+
+static inline bool move_eq(move_t move1, move_t move2) {
+    return move1 == move2;
+}
+
+template <int N>
+tak_game_t<N> new_tak_game();
+
+/* write a position in TPS notation, or read one back; game_from_tps returns
+false if the string isn't a valid position */
+template <int N>
+std::string game_to_tps(const tak_game_t<N> *game);
+
+template <int N>
+bool game_from_tps(const std::string &tps, tak_game_t<N> *game);
+
+/* read a move written as in the TUI, (type)(square)[direction][drops]:
+f/w/c/m for flat, wall, capstone or tower move, the square as a1, then for
+tower moves w/a/s/d and digits for the pieces left behind and those dropped
+on each square after. Digits left out leave nothing behind and drop one
+piece per square while the tower lasts, and the pieces still carried go
+N - 1 squares away. Returns false unless the string spells out a move legal
+in the game. */
+template <int N>
+bool move_from_string(const std::string &str, tak_game_t<N> *game, move_t *move);
+
+/* compute the Zobrist hash of a position from scratch */
+template <int N>
+uint64_t game_hash(const tak_game_t<N> *game);
+
+/* symmetries of the board: the rotations and reflections of the square. A
+symmetry maps positions and moves alike, so a move m of a position is legal
+exactly when transform_move(m, s) is in the position's image under s. */
+#define N_SYMMETRIES 8
+
+/* map a move, which is also its policy head index, under a symmetry */
+template <int N>
+move_t transform_move(move_t move, int sym);
 
-float tiles_eval(tak_game_t *game);
+/* pick the orientation of a position with the smallest hash, so that all 8
+orientations share one canonical form. Returns the symmetry that maps the
+position to it and writes the canonical hash. */
+template <int N>
+int canonical_symmetry(const tak_game_t<N> *game, uint64_t *hash);
 
-bool move_eq(move_t move1, move_t move2);
+template <int N>
+int get_tower_height(tak_game_t<N> *game, uint8_t i, uint8_t j);
 
-tak_game_t new_tak_game();
+/* piece at depth h (0 is the top) of a tower, using 1 and 2 for flat pieces
+of p1 and p2, 11 and 12 for walls, 21 and 22 for capstones and 0 for no
+piece */
+template <int N>
+uint8_t get_piece(const tak_game_t<N> *game, uint8_t i, uint8_t j, int h);
 
-int get_tower_height(tak_game_t *game, uint8_t i, uint8_t j);
+/* expand the game into the byte-per-piece board layout used by the training data */
+template <int N>
+void game_to_board(const tak_game_t<N> *game, uint8_t board[N][N][BOARD_DEPTH]);
 
-#endif // define GAME_H_
\ No newline at end of file
+#endif // define GAME_H_
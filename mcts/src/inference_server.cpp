@@ -0,0 +1,140 @@
+#include "inference_server.hpp"
+#include <algorithm>
+
+/* take jobs off the queue until the batch is full; a job is never split, so
+the batch can only exceed max_batch when a single job is larger */
+template <int N>
+void take_jobs(inference_server_t<N> *server, std::vector<inference_job_t<N> *> &jobs) {
+    int size = 0;
+    while (server->head != NULL) {
+        inference_job_t<N> *job = server->head;
+        if (size > 0 && size + job->n > server->max_batch) {
+            break;
+        }
+        server->head = job->next;
+        if (server->head == NULL) {
+            server->tail = NULL;
+        }
+        server->n_queued -= job->n;
+        size += job->n;
+        jobs.push_back(job);
+    }
+}
+
+/* evaluate the jobs taken off the queue, without holding the lock; returns
+the error if the forward pass failed */
+template <int N>
+std::exception_ptr run_jobs(inference_server_t<N> *server, std::vector<inference_job_t<N> *> &jobs) {
+    std::vector<eval_request_t<N>> &batch = server->batch;
+    batch.clear();
+    for (inference_job_t<N> *job: jobs) {
+        batch.insert(batch.end(), job->requests, job->requests + job->n);
+    }
+
+    try {
+        get_eval(*server->model, &server->workspace, batch.data(), batch.size());
+    } catch (...) {
+        return std::current_exception();
+    }
+
+    // priors were written through the requests' pointers; copy back the values
+    int k = 0;
+    for (inference_job_t<N> *job: jobs) {
+        for (int b = 0; b < job->n; b++) {
+            job->requests[b].val = batch[k++].val;
+        }
+    }
+    return std::exception_ptr();
+}
+
+template <int N>
+void serve(inference_server_t<N> *server) {
+    std::vector<inference_job_t<N> *> jobs;
+    std::unique_lock<std::mutex> guard(server->lock);
+    while (true) {
+        server->wake.wait(guard, [server] {
+            return server->stop || server->head != NULL;
+        });
+        if (server->head == NULL) {
+            return; // stopped with nothing left to do
+        }
+
+        /* give other callers until the oldest job has waited for the timeout
+        to fill the batch. Jobs queued during the last forward pass, or left
+        over from a full batch, have been waiting already, so the deadline is
+        not counted from now. */
+        auto deadline = server->head->submitted + server->timeout;
+        server->wake.wait_until(guard, deadline, [server] {
+            return server->stop || server->n_queued >= server->max_batch;
+        });
+
+        jobs.clear();
+        take_jobs(server, jobs);
+        guard.unlock();
+        std::exception_ptr error = run_jobs(server, jobs);
+        guard.lock();
+
+        /* callers are woken while the lock is held: once a caller sees its
+        job done it returns, and its job goes away with it */
+        for (inference_job_t<N> *job: jobs) {
+            job->error = error;
+            job->done = true;
+            job->finished.notify_one();
+        }
+    }
+}
+
+template <int N>
+inference_server_t<N> *new_inference_server(model_t *model, int max_batch, int timeout_us) {
+    inference_server_t<N> *server = new inference_server_t<N>();
+    server->model = model;
+    server->max_batch = std::max(max_batch, 1);
+    server->timeout = std::chrono::microseconds(timeout_us);
+    server->head = NULL;
+    server->tail = NULL;
+    server->n_queued = 0;
+    server->stop = false;
+    server->thread = std::thread(serve<N>, server);
+    return server;
+}
+
+template <int N>
+void free_inference_server(inference_server_t<N> *server) {
+    {
+        std::lock_guard<std::mutex> guard(server->lock);
+        server->stop = true;
+    }
+    server->wake.notify_one();
+    server->thread.join();
+    delete server;
+}
+
+template <int N>
+void submit_eval(inference_server_t<N> *server, inference_job_t<N> *job) {
+    std::unique_lock<std::mutex> guard(server->lock);
+    job->submitted = std::chrono::steady_clock::now();
+    job->next = NULL;
+    job->done = false;
+    if (server->tail != NULL) {
+        server->tail->next = job;
+    } else {
+        server->head = job;
+    }
+    server->tail = job;
+    server->n_queued += job->n;
+    server->wake.notify_one();
+
+    job->finished.wait(guard, [job] {
+        return job->done;
+    });
+    if (job->error) {
+        std::rethrow_exception(job->error);
+    }
+}
+
+#define INSTANTIATE_INFERENCE_SERVER(N) \
+    template inference_server_t<N> *new_inference_server<N>(model_t *, int, int); \
+    template void free_inference_server<N>(inference_server_t<N> *); \
+    template void submit_eval<N>(inference_server_t<N> *, inference_job_t<N> *);
+
+FOR_EACH_BOARD_SIZE(INSTANTIATE_INFERENCE_SERVER)
@@ -0,0 +1,59 @@
+#ifndef INFERENCE_SERVER_H_
+#define INFERENCE_SERVER_H_
+
+#include "ai_model.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* requests submitted together by one caller, completed as a unit. A job
+lives with its caller and is linked into the server's queue, so submitting
+one allocates nothing. Every field past n belongs to the server and is
+guarded by its lock. */
+template <int N>
+struct inference_job_t {
+    eval_request_t<N> *requests;
+    int n;
+    std::chrono::steady_clock::time_point submitted;
+    inference_job_t *next; // the next job in the queue
+    bool done;
+    std::exception_ptr error; // set if the forward pass failed
+    std::condition_variable finished; // signalled once done is set
+};
+
+/* evaluator thread shared by many searches. Callers submit positions, and
+the thread gathers them into a single forward pass once max_batch positions
+are waiting or the oldest waiting job has waited for timeout. */
+template <int N>
+struct inference_server_t {
+    model_t *model; // not owned
+    int max_batch;
+    inference_workspace_t<N> workspace; // used only by the server thread
+    std::vector<eval_request_t<N>> batch; // requests of the batch being evaluated
+    std::chrono::microseconds timeout;
+
+    std::mutex lock;
+    std::condition_variable wake; // signalled on new jobs and on stop
+    inference_job_t<N> *head; // queued jobs, oldest first
+    inference_job_t<N> *tail;
+    int n_queued; // positions over all queued jobs
+    bool stop;
+    std::thread thread;
+};
+
+template <int N>
+inference_server_t<N> *new_inference_server(model_t *model, int max_batch, int timeout_us);
+
+/* evaluate the queued jobs, then stop the thread and release the server */
+template <int N>
+void free_inference_server(inference_server_t<N> *server);
+
+/* queue a batch of positions and wait until the server has evaluated them;
+an error from the forward pass is rethrown here */
+template <int N>
+void submit_eval(inference_server_t<N> *server, inference_job_t<N> *job);
+
+#endif // define INFERENCE_SERVER_H_
@@ -5,138 +5,420 @@
 #include <iostream>
 #include <fstream>
 #include <boost/json.hpp>
-#include <stdexcept>
+#include <algorithm>
+#include <new>
+#include <thread>
+#include <chrono>
+#include <climits>
 
 namespace json = boost::json;
-void write_results(mcts_node_t *final_state, std::ofstream &file);
 
 bool isclose(float a, float b) {
     return abs(a - b) < 1e-6;
 }
 
-/* initialize a node; create its children but leave them uninitialized */
-void init_node(mcts_node_t *node) {
-    std::vector<move_t> valid_moves = available_moves(&node->game);
-    
-    node->moves = valid_moves;
-    if (node->use_ai) {
-        std::vector<float> P;
-        float val = get_eval(node->model, &node->game, valid_moves, P);
-        node->val = val;
-        node->P = P;
-    } else {
-        float p = 1 / ((float) valid_moves.size());
-        std::vector<float> P(valid_moves.size(), p);
-        node->val = tiles_eval(&node->game);   
-        node->P = P; 
-    }
-
-    // create children with proper game, N, game_ended, is_initialized fields
-    for (auto m: valid_moves) {
-        mcts_node_t child = {0};
-        child.model = node->model;
-        child.parent = node;
-        child.use_ai = node->use_ai;
-        apply_move(&child.game, &node->game, &m);
-
-
-        child.N = 0;
-        child.val = 0;
-        switch (game_outcome(&child.game)) {
-            case IN_PROGRESS:
-                child.game_ended = false;
-                child.is_initialized = false;
-                break;
-            case P1_WIN:
-                child.game_ended = true;
-                child.val = (child.game.turn == 1) ? 1 : -1;
-                child.is_initialized = true;
-                break;
-            case P2_WIN:
-                child.game_ended = true;
-                child.val = (child.game.turn == 2) ? 1 : -1;
-                child.is_initialized = true;
-                break;
-            case TIE:
-                child.game_ended = true;
-                child.val = 0;
-                child.is_initialized = true;
-                break;
+/* allocate a node in an arena, with every field zeroed; like arena arrays,
+nodes are never destroyed */
+template <int N>
+mcts_node_t<N> *alloc_node(arena_t *arena) {
+    static_assert(std::is_trivially_destructible<mcts_node_t<N>>::value, "nodes are never destroyed");
+    return new (arena_alloc(arena, sizeof(mcts_node_t<N>))) mcts_node_t<N>();
+}
+
+/* add to an atomic float; std::atomic<float> has no fetch_add before C++20 */
+void atomic_add(std::atomic<float> *x, float v) {
+    float old = x->load(std::memory_order_relaxed);
+    while (!x->compare_exchange_weak(old, old + v, std::memory_order_relaxed)) {
+    }
+}
+
+/* allocate a node for game, the position reached by a move; terminal
+positions are marked as ready, with their value set from the result */
+template <int N>
+mcts_node_t<N> *new_node(arena_t *arena, tak_game_t<N> *game, int idx) {
+    mcts_node_t<N> *child = alloc_node<N>(arena);
+    child->idx = idx;
+    child->hash = game->hash;
+
+    switch (game_outcome(game)) {
+        case IN_PROGRESS:
+            child->game_ended = false;
+            child->state.store(NODE_NEW, std::memory_order_relaxed);
+            break;
+        case P1_WIN:
+            child->game_ended = true;
+            child->val = (game->turn == 1) ? 1 : -1;
+            child->state.store(NODE_READY, std::memory_order_relaxed);
+            break;
+        case P2_WIN:
+            child->game_ended = true;
+            child->val = (game->turn == 2) ? 1 : -1;
+            child->state.store(NODE_READY, std::memory_order_relaxed);
+            break;
+        case TIE:
+            child->game_ended = true;
+            child->val = 0;
+            child->state.store(NODE_READY, std::memory_order_relaxed);
+            break;
+    }
+    return child;
+}
+
+/* get the child reached by a move, whose position is game, creating it if
+needed. When two workers race to create the same child, the loser's copy is
+left unused in its arena. */
+template <int N>
+mcts_node_t<N> *get_child(arena_t *arena, mcts_node_t<N> *node, int idx, tak_game_t<N> *game) {
+    mcts_node_t<N> *child = node->children[idx].load(std::memory_order_acquire);
+    if (child != NULL) {
+        return child;
+    }
+    mcts_node_t<N> *created = new_node(arena, game, idx);
+    if (node->children[idx].compare_exchange_strong(child, created,
+            std::memory_order_acq_rel, std::memory_order_acquire)) {
+        return created;
+    }
+    return child;
+}
+
+/* set up the statistics for a node's children, which are created when they
+are first selected, and return the request for its evaluation; game is the
+node's position and must outlive the request. The caller must have moved
+the node to NODE_EXPANDING. */
+template <int N>
+eval_request_t<N> expand_node(arena_t *arena, mcts_node_t<N> *node, tak_game_t<N> *game) {
+    move_list_t<N> moves;
+    available_moves(game, &moves);
+    int n = moves.size;
+
+    node->n_children = n;
+    node->moves = arena_array<move_t>(arena, n);
+    node->P = arena_array<float>(arena, n);
+    node->W = arena_array<std::atomic<float>>(arena, n);
+    node->N = arena_array<std::atomic<int>>(arena, n);
+    node->children = arena_array<std::atomic<mcts_node_t<N> *>>(arena, n);
+    std::copy_n(moves.moves, n, node->moves);
+    for (int i = 0; i < n; i++) {
+        new (&node->W[i]) std::atomic<float>(0.f);
+        new (&node->N[i]) std::atomic<int>(0);
+        new (&node->children[i]) std::atomic<mcts_node_t<N> *>(NULL);
+    }
+
+    return eval_request_t<N>{game, node->moves, n, node->P, 0};
+}
+
+/* record the evaluation of an expanded node and publish it to the other
+search workers */
+template <int N>
+void finish_node(mcts_node_t<N> *node, eval_request_t<N> *req) {
+    node->val = req->val;
+    node->state.store(NODE_READY, std::memory_order_release);
+}
+
+/* initialize the root on its own, outside of a search */
+template <int N>
+void init_root(mcts_tree_t<N> *tree) {
+    mcts_node_t<N> *node = tree->root;
+    node->state.store(NODE_EXPANDING, std::memory_order_relaxed);
+    eval_request_t<N> req = expand_node(&tree->arena, node, &tree->game);
+    evaluate_batch(tree->eval, &tree->workspaces[0], &req, 1);
+    finish_node(node, &req);
+}
+
+/* value added to W along a path while its leaf waits for evaluation; this
+makes the path look like a loss so other descents, from the same batch or
+from other workers, avoid it */
+#define VIRTUAL_LOSS 1
+
+/* descend from the root to a leaf by upper confidence bound, adding a
+virtual loss to each edge taken and playing the moves on a copy of the
+root position. The descent also stops at a ready node once the path is
+full, which is then treated as a leaf. */
+template <int N>
+void select_leaf(arena_t *arena, mcts_tree_t<N> *tree, float lambda, search_path_t<N> *path) {
+    mcts_node_t<N> *node = tree->root;
+    path->nodes[0] = node;
+    path->len = 1;
+    path->game = tree->game;
+
+    while (!node->game_ended && path->len < MAX_PATH
+            && node->state.load(std::memory_order_acquire) == NODE_READY) {
+        float max_ucb = -INFINITY; // max upper confidence bound
+        int best = -1;
+        assert(node->n_children > 0);
+
+        for (int i = 0; i < node->n_children; i++) {
+            int n = node->N[i].load(std::memory_order_relaxed);
+            float w = node->W[i].load(std::memory_order_relaxed);
+            // unvisited children count as even positions
+            float q = n > 0 ? w / n : 0;
+            float conf_factor = sqrtf(1 / (1 + (float) n));
+            float ucb = -q + lambda * node->P[i] * conf_factor;
+            if (ucb > max_ucb) {
+                max_ucb = ucb;
+                best = i;
+            }
+        }
+
+        assert(best != -1);
+        undo_t<N> undo; // the descent never goes back up
+        make_move(&path->game, node->moves[best], &undo);
+        mcts_node_t<N> *child = get_child(arena, node, best, &path->game);
+        assert(child->hash == path->game.hash);
+        if (child->state.load(std::memory_order_acquire) == NODE_READY) {
+            // start loading the child's statistics while the edge is updated
+            __builtin_prefetch(child->N);
+            __builtin_prefetch(child->W);
+            __builtin_prefetch(child->P);
+            __builtin_prefetch(child->moves);
         }
-        node->children.push_back(child);
+        node->N[best].fetch_add(1, std::memory_order_relaxed);
+        atomic_add(&node->W[best], VIRTUAL_LOSS);
+
+        path->nodes[path->len++] = child;
+        node = child;
     }
-    node->is_initialized = true;
 }
 
-/* perform a step of MCTS search */
-float search(mcts_node_t *node, float lambda) {
-    if (node->game_ended) {
-        return -node->val;
+/* walk a path back up to the root, replacing the virtual loss on each edge
+with the leaf's value; val is from the perspective of the player to move
+at the leaf. If visit is false the descent is discarded instead. */
+template <int N>
+void backup(search_path_t<N> *path, float val, bool visit) {
+    for (int d = path->len - 1; d > 0; d--) {
+        mcts_node_t<N> *parent = path->nodes[d - 1];
+        int idx = path->nodes[d]->idx;
+        if (visit) {
+            atomic_add(&parent->W[idx], val - VIRTUAL_LOSS);
+        } else {
+            atomic_add(&parent->W[idx], -VIRTUAL_LOSS);
+            parent->N[idx].fetch_sub(1, std::memory_order_relaxed);
+        }
+        val = -val;
     }
+}
 
-    if (!node->is_initialized) {
-        /* set val, moves, P, children for node */
-        init_node(node);
-        return -node->val;
+/* perform a step of MCTS search: select up to batch_size leaves, evaluate
+the new ones together and back up their values. Several workers may search
+the same tree at once, each allocating from its own arena. */
+template <int N>
+void search(mcts_tree_t<N> *tree, arena_t *arena, inference_workspace_t<N> *workspace,
+        search_batch_t<N> *batch, int batch_size, float lambda) {
+    if (batch->paths.size() < (size_t) batch_size) {
+        batch->paths.resize(batch_size);
+    }
+    batch->requests.clear();
+    int n_leaves = 0;
+    for (int k = 0; k < batch_size; k++) {
+        search_path_t<N> *path = &batch->paths[n_leaves];
+        select_leaf(arena, tree, lambda, path);
+        mcts_node_t<N> *leaf = path->nodes[path->len - 1];
+        uint8_t expected = NODE_NEW;
+        if (leaf->game_ended || leaf->state.load(std::memory_order_acquire) == NODE_READY) {
+            // a finished game, or an evaluated node at the end of a full path
+            backup(path, leaf->val, true);
+        } else if (!leaf->state.compare_exchange_strong(expected, NODE_EXPANDING,
+                std::memory_order_relaxed)) {
+            // another descent already reached this leaf and is expanding it
+            backup(path, 0, false);
+        } else {
+            /* set val, moves, P and child statistics for the leaf */
+            batch->requests.push_back(expand_node(arena, leaf, &path->game));
+            n_leaves++;
+        }
     }
 
-    float max_ucb = -INFINITY; // max upper confidence bound
-    mcts_node_t *best_child = NULL;
-    assert(node->children.size() > 0);
+    evaluate_batch(tree->eval, workspace, batch->requests.data(), n_leaves);
 
+    for (int k = 0; k < n_leaves; k++) {
+        search_path_t<N> *path = &batch->paths[k];
+        mcts_node_t<N> *leaf = path->nodes[path->len - 1];
+        finish_node(leaf, &batch->requests[k]);
+        backup(path, leaf->val, true);
+    }
+}
 
-    for (int i = 0; i < node->children.size(); i++) {
-        mcts_node_t *child = &node->children[i];
-        float conf_factor = sqrtf(1 / (1 + (float) child->N));
-        float ucb = -child->val + lambda * node->P[i] * conf_factor;
-        if (ucb > max_ucb) {
-            max_ucb = ucb;
-            best_child = child;
+/* progress of a search, shared by its workers */
+typedef struct {
+    const search_limits_t *limits;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point deadline;
+    int batch_size;
+    int root_visits; // visits at the root before the search
+    std::atomic<int> claimed; // descents claimed by the workers
+    std::atomic<size_t> memory; // bytes held by the tree's arenas
+    std::atomic<bool> stop;
+} search_state_t;
+
+/* check the root every this many descents for early stopping */
+#define EARLY_STOP_INTERVAL 64
+
+/* whether the most visited root child can still be overtaken by the
+descents the limits leave, in which case the search should go on */
+template <int N>
+bool can_change(mcts_tree_t<N> *tree, search_state_t *state, int claimed) {
+    const search_limits_t *limits = state->limits;
+    long remaining = LONG_MAX;
+    if (limits->playouts > 0) {
+        remaining = std::min(remaining, (long) limits->playouts - claimed);
+    }
+    if (limits->visits > 0) {
+        remaining = std::min(remaining, (long) limits->visits - state->root_visits - claimed);
+    }
+    if (limits->time > 0) {
+        // extrapolate from the rate so far
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - state->start).count();
+        double left = std::chrono::duration<double>(state->deadline - now).count();
+        remaining = std::min(remaining, (long) (claimed / std::max(elapsed, 1e-9) * left));
+    }
+    if (remaining == LONG_MAX) {
+        return true;
+    }
+
+    mcts_node_t<N> *root = tree->root;
+    int first = 0;
+    int second = 0;
+    for (int i = 0; i < root->n_children; i++) {
+        int n = root->N[i].load(std::memory_order_relaxed);
+        if (n > first) {
+            second = first;
+            first = n;
+        } else if (n > second) {
+            second = n;
         }
     }
+    return second + remaining >= first;
+}
+
+/* claim the next batch of descents, returning its size or 0 once a limit
+is reached */
+template <int N>
+int claim_batch(mcts_tree_t<N> *tree, search_state_t *state) {
+    const search_limits_t *limits = state->limits;
+    if (state->stop.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+    int start = state->claimed.fetch_add(state->batch_size, std::memory_order_relaxed);
+    int size = state->batch_size;
+    if (limits->playouts > 0) {
+        size = std::min(size, limits->playouts - start);
+    }
+    if (limits->visits > 0) {
+        size = std::min(size, limits->visits - state->root_visits - start);
+    }
 
-    assert(best_child != NULL);
-    float val = search(best_child, lambda);
-    
-    best_child->val = (((float) best_child->N) * best_child->val - val)/((float) best_child->N + 1);
-    best_child->N += 1;
+    // always run the first batch so that the root has visits to choose from
+    bool stop = size <= 0;
+    if (start > 0) {
+        stop = stop || (limits->time > 0 && std::chrono::steady_clock::now() >= state->deadline);
+        stop = stop || (limits->memory > 0 && state->memory.load(std::memory_order_relaxed) >= limits->memory);
+        stop = stop || (limits->early_stop
+            && start / state->batch_size % EARLY_STOP_INTERVAL == 0
+            && !can_change(tree, state, start));
+    }
+    if (stop) {
+        state->stop.store(true, std::memory_order_relaxed);
+        return 0;
+    }
+    return size;
+}
 
-    return -val;
+/* run batches of descents until the search reaches one of its limits */
+template <int N>
+void search_worker(mcts_tree_t<N> *tree, arena_t *arena, inference_workspace_t<N> *workspace,
+        search_batch_t<N> *batch, search_state_t *state) {
+    size_t used = arena->total;
+    while (int size = claim_batch(tree, state)) {
+        search(tree, arena, workspace, batch, size, 1);
+        state->memory.fetch_add(arena->total - used, std::memory_order_relaxed);
+        used = arena->total;
+    }
+}
+
+/* run a search from the root of the tree within the given limits. With
+several workers the search is tree-parallel: every worker descends the same
+tree, and virtual loss spreads them over different lines. */
+template <int N>
+void run_search(mcts_tree_t<N> *tree, const search_limits_t *limits) {
+    mcts_node_t<N> *node = tree->root;
+    int n_workers = std::max(tree->eval->n_workers, 1);
+    if (node->state.load(std::memory_order_relaxed) != NODE_READY) {
+        // expand the root first so that the workers don't collide on it
+        init_root(tree);
+    }
+    if (tree->worker_arenas.size() < (size_t) n_workers - 1) {
+        tree->worker_arenas.resize(n_workers - 1);
+    }
+    if (tree->workspaces.size() < (size_t) n_workers) {
+        tree->workspaces.resize(n_workers);
+        tree->batches.resize(n_workers);
+    }
+
+    assert(limits->playouts > 0 || limits->visits > 0 || limits->time > 0 || limits->memory > 0);
+    search_state_t state;
+    state.limits = limits;
+    state.start = std::chrono::steady_clock::now();
+    state.deadline = state.start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(limits->time));
+    state.batch_size = std::max(tree->eval->batch_size, 1);
+    state.root_visits = 0;
+    for (int i = 0; i < node->n_children; i++) {
+        state.root_visits += node->N[i].load(std::memory_order_relaxed);
+    }
+    state.claimed = 0;
+    state.memory = tree->arena.total;
+    for (arena_t &arena: tree->worker_arenas) {
+        state.memory += arena.total;
+    }
+    state.stop = false;
+
+    std::vector<std::thread> workers;
+    for (int t = 1; t < n_workers; t++) {
+        workers.emplace_back(search_worker<N>, tree, &tree->worker_arenas[t - 1],
+            &tree->workspaces[t], &tree->batches[t], &state);
+    }
+    search_worker(tree, &tree->arena, &tree->workspaces[0], &tree->batches[0], &state);
+    for (std::thread &worker: workers) {
+        worker.join();
+    }
 }
 
 /* get probability distribution for moves based on MCTS */
-std::vector<float> get_prob(mcts_node_t const *node, float temp) {
+template <int N>
+std::vector<float> get_prob(mcts_node_t<N> const *node, float temp) {
     assert(isclose(temp, 1)); // TODO: implement different values for temperature
     int N_tot = 0;
-    for (auto c: node->children) {
-        N_tot += c.N;
+    for (int i = 0; i < node->n_children; i++) {
+        N_tot += node->N[i];
     }
     assert(N_tot != 0);
 
     std::vector<float> P;
-    for (auto c: node->children) {
-        float p = ((float) c.N) / ((float) N_tot);
+    for (int i = 0; i < node->n_children; i++) {
+        float p = ((float) node->N[i]) / ((float) N_tot);
         P.push_back(p);
     }
     return P;
 }
 
-/* get move based on MCTS */
-move_t get_move(mcts_node_t *node, int repetitions) {
-    for (int i = 0; i < repetitions; i++) {
-        search(node, 1);
-    }
-    assert(node->is_initialized);
+/* search within the limits, then sample a move by visit count */
+template <int N>
+move_t get_move_limited(mcts_tree_t<N> *tree, const search_limits_t *limits) {
+    mcts_node_t<N> *node = tree->root;
+    run_search(tree, limits);
+
+    assert(node->state.load() == NODE_READY);
     assert(!node->game_ended);
-    assert(node->moves.size() > 0);
+    assert(node->n_children > 0);
 
     std::vector<float> P = get_prob(node, 1);
 
     float r = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
 
     float tot = 0;
-    move_t move;
-    for (int i = 0; i < node->children.size(); i++) {
+    move_t move = node->moves[node->n_children - 1];
+    for (int i = 0; i < node->n_children; i++) {
         tot += P[i];
         if (tot > r) {
             move = node->moves[i];
@@ -146,46 +428,137 @@ move_t get_move(mcts_node_t *node, int repetitions) {
     return move;
 }
 
-/* return the node in the tree search after applying a move */
-mcts_node_t* mcts_apply_move(mcts_node_t *node, move_t move) {
-    if (!node->is_initialized) {
-        init_node(node);
+/* get move based on MCTS */
+template <int N>
+move_t get_move(mcts_tree_t<N> *tree, int repetitions) {
+    search_limits_t limits = {};
+    limits.playouts = repetitions;
+    return get_move_limited(tree, &limits);
+}
+
+search_limits_t move_limits(int playouts, double time, bool playouts_given) {
+    search_limits_t limits = {};
+    limits.playouts = time > 0 && !playouts_given ? 0 : playouts;
+    limits.time = time;
+    return limits;
+}
+
+/* copy a node into an arena, without its children */
+template <int N>
+mcts_node_t<N> *copy_node(arena_t *arena, mcts_node_t<N> *node) {
+    mcts_node_t<N> *copy = alloc_node<N>(arena);
+    copy->hash = node->hash;
+    copy->val = node->val;
+    copy->state.store(node->state.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    copy->game_ended = node->game_ended;
+    copy->idx = node->idx;
+
+    int n = node->n_children;
+    if (n > 0) {
+        copy->n_children = n;
+        copy->moves = arena_array<move_t>(arena, n);
+        copy->P = arena_array<float>(arena, n);
+        copy->W = arena_array<std::atomic<float>>(arena, n);
+        copy->N = arena_array<std::atomic<int>>(arena, n);
+        copy->children = arena_array<std::atomic<mcts_node_t<N> *>>(arena, n);
+        std::copy_n(node->moves, n, copy->moves);
+        std::copy_n(node->P, n, copy->P);
+        for (int i = 0; i < n; i++) {
+            new (&copy->W[i]) std::atomic<float>(node->W[i].load(std::memory_order_relaxed));
+            new (&copy->N[i]) std::atomic<int>(node->N[i].load(std::memory_order_relaxed));
+            new (&copy->children[i]) std::atomic<mcts_node_t<N> *>(NULL);
+        }
     }
-    for (int i = 0; i < node->children.size(); i++) {
-        move_t m = node->moves[i];
-        if (move_eq(move, m)) {
-            return &node->children[i];
+    return copy;
+}
+
+/* copy a subtree into an arena, returning the new root of the subtree */
+template <int N>
+mcts_node_t<N> *copy_subtree(arena_t *arena, mcts_node_t<N> *root) {
+    mcts_node_t<N> *new_root = copy_node(arena, root);
+    std::vector<std::pair<mcts_node_t<N> *, mcts_node_t<N> *>> stack = {{root, new_root}};
+    while (!stack.empty()) {
+        auto [node, copy] = stack.back();
+        stack.pop_back();
+        for (int i = 0; i < node->n_children; i++) {
+            mcts_node_t<N> *child = node->children[i].load(std::memory_order_relaxed);
+            if (child != NULL) {
+                mcts_node_t<N> *child_copy = copy_node(arena, child);
+                copy->children[i].store(child_copy, std::memory_order_relaxed);
+                stack.push_back({child, child_copy});
+            }
+        }
+    }
+    return new_root;
+}
+
+/* move the root of the tree to the node reached by a move, keeping the
+statistics below it. The other branches are interleaved with the kept one
+in the arenas, so the kept subtree is copied into a fresh arena and the old
+arenas are released whole; memory stays bounded by the live tree, and the
+cost is proportional to the kept subtree rather than to the whole tree.
+Returns the number of visits reused from the previous search. */
+template <int N>
+int advance_root(mcts_tree_t<N> *tree, move_t move) {
+    mcts_node_t<N> *node = tree->root;
+    if (node->state.load(std::memory_order_relaxed) != NODE_READY) {
+        init_root(tree);
+    }
+    for (int i = 0; i < node->n_children; i++) {
+        if (move_eq(move, node->moves[i])) {
+            int reused = node->N[i].load(std::memory_order_relaxed);
+            tak_game_t<N> game;
+            apply_move(&game, &tree->game, move);
+            mcts_node_t<N> *child = get_child(&tree->arena, node, i, &game);
+            tree->game = game;
+
+            arena_t arena = {};
+            tree->root = copy_subtree(&arena, child);
+            arena_free(&tree->arena);
+            for (arena_t &worker_arena: tree->worker_arenas) {
+                arena_free(&worker_arena);
+            }
+            tree->arena = std::move(arena);
+            return reused;
         }
     }
     assert(false);
+    return 0;
+}
+
+/* move the root of the tree search to the node reached by a move */
+template <int N>
+mcts_node_t<N>* mcts_apply_move(mcts_tree_t<N> *tree, move_t move) {
+    advance_root(tree, move);
+    return tree->root;
 }
 
 /* simulate two bots playing a game */
-int oppose_bots_h(tak_game_t game, int repetitions, mcts_node_t root1, mcts_node_t root2) {
-    mcts_node_t *mcts1 = &root1;
-    mcts_node_t *mcts2 = &root2;
+template <int N>
+int oppose_bots_h(tak_game_t<N> game, search_limits_t limits, mcts_tree_t<N> *tree1, mcts_tree_t<N> *tree2) {
+    mcts_node_t<N> *mcts1 = tree1->root;
 
     int c = 0;
     while (!mcts1->game_ended) {
-        move_t move1 = get_move(mcts1, repetitions);
+        move_t move1 = get_move_limited(tree1, &limits);
 
 
-        mcts1 = mcts_apply_move(mcts1, move1);
-        mcts2 = mcts_apply_move(mcts2, move1);
+        mcts1 = mcts_apply_move(tree1, move1);
+        mcts_apply_move(tree2, move1);
 
         if (mcts1->game_ended) {
             break;
         }
 
-        move_t move2 = get_move(mcts2, repetitions);
+        move_t move2 = get_move_limited(tree2, &limits);
 
-        mcts1 = mcts_apply_move(mcts1, move2);
-        mcts2 = mcts_apply_move(mcts2, move2);
+        mcts1 = mcts_apply_move(tree1, move2);
+        mcts_apply_move(tree2, move2);
 
         c++;
     }
     std::cout << "GAME FINISHED after " << c << " turns \n";
-    switch (game_outcome(&mcts1->game)) {
+    switch (game_outcome(&tree1->game)) {
         case P1_WIN:
             std::cout << "Player 1 wins!\n";
             return 1;
@@ -197,63 +570,113 @@ int oppose_bots_h(tak_game_t game, int repetitions, mcts_node_t root1, mcts_node
             return 0;
         default:
             assert(false);
+            return 0;
     }
 }
 
 /* simulate two botts playing a game */
-int oppose_bots(tak_game_t game, int repetitions, model_t &model1, model_t &model2, bool bot2_default) {
-    mcts_node_t root1 = new_mcts(game, model1, true);
-    mcts_node_t root2 = new_mcts(game, model2, !bot2_default);
-    return oppose_bots_h(game, repetitions, root1, root2);
+template <int N>
+int oppose_bots(tak_game_t<N> game, search_limits_t limits, evaluator_t<N> *eval1, evaluator_t<N> *eval2) {
+    mcts_tree_t<N> *tree1 = new_mcts(game, eval1);
+    mcts_tree_t<N> *tree2 = new_mcts(game, eval2);
+    int res = oppose_bots_h(game, limits, tree1, tree2);
+    free_mcts(tree1);
+    free_mcts(tree2);
+    return res;
+}
+
+/* record the searched root of a tree for the training data */
+template <int N>
+search_record_t<N> make_record(mcts_tree_t<N> *tree) {
+    mcts_node_t<N> *node = tree->root;
+    search_record_t<N> record;
+    record.game = tree->game;
+    record.moves.assign(node->moves, node->moves + node->n_children);
+    record.p = get_prob(node, 1);
+    record.val = 0;
+    record.ply = 0;
+    return record;
 }
 
 /* simulate a bot playing itself */
-void simulate(tak_game_t game, int repetitions, std::ofstream &file, model_t &model, bool use_ai) {
-    mcts_node_t root1 = new_mcts(game, model, use_ai);
+template <int N>
+std::vector<search_record_t<N>> simulate(tak_game_t<N> game, search_limits_t limits, evaluator_t<N> *eval) {
+    mcts_tree_t<N> *tree = new_mcts(game, eval);
+    // the tree only keeps the current subtree, so record positions as we go
+    std::vector<search_record_t<N>> history;
 
-    mcts_node_t *mcts1 = &root1;
+    mcts_node_t<N> *mcts1 = tree->root;
 
     int c = 0;
     while (!mcts1->game_ended) {
-        move_t move1 = get_move(mcts1, repetitions);
-        mcts1 = mcts_apply_move(mcts1, move1);
+        move_t move1 = get_move_limited(tree, &limits);
+        history.push_back(make_record(tree));
+        mcts1 = mcts_apply_move(tree, move1);
 
         if (mcts1->game_ended) {
             break;
         }
-        move_t move2 = get_move(mcts1, repetitions);
+        move_t move2 = get_move_limited(tree, &limits);
+        history.push_back(make_record(tree));
 
-        mcts1 = mcts_apply_move(mcts1, move2);
+        mcts1 = mcts_apply_move(tree, move2);
         c++;
     }
-    write_results(mcts1, file);
+    // mcts1->val is the result for the player to move at the end
+    float val = -mcts1->val;
+    for (int k = history.size() - 1; k >= 0; k--) {
+        history[k].val = val;
+        history[k].ply = k;
+        val = -val;
+    }
+    free_mcts(tree);
+    return history;
 }
 
-/* create a new mcts node */
-mcts_node_t new_mcts(tak_game_t game, model_t &model, bool use_ai) {
+/* create a new search tree rooted at a game */
+template <int N>
+mcts_tree_t<N> *new_mcts(tak_game_t<N> game, evaluator_t<N> *eval) {
     /* assumes game is not over */
-    mcts_node_t node = {0};
-    node.game = game;
-    node.is_initialized = false;
-    node.game_ended = false;
-    node.N = 0;
-    node.model = model;
-    node.use_ai = use_ai;
-    return node;
+    mcts_tree_t<N> *tree = new mcts_tree_t<N>();
+    tree->eval = eval;
+    tree->workspaces.resize(1);
+    tree->batches.resize(1);
+
+    tree->game = game;
+    tree->root = alloc_node<N>(&tree->arena);
+    tree->root->hash = game.hash;
+    tree->root->state.store(NODE_NEW, std::memory_order_relaxed);
+    tree->root->game_ended = false;
+    return tree;
+}
+
+/* release a search tree and all of its nodes */
+template <int N>
+void free_mcts(mcts_tree_t<N> *tree) {
+    arena_free(&tree->arena);
+    for (arena_t &arena: tree->worker_arenas) {
+        arena_free(&arena);
+    }
+    delete tree;
 }
 
 /* SERIALIZATION FUNCTIONS */
 
-void tag_invoke( json::value_from_tag, json::value &jv, tak_game_t const &game) {
+template <int N>
+void tag_invoke( json::value_from_tag, json::value &jv, tak_game_t<N> const &game) {
+    uint8_t board[N][N][BOARD_DEPTH];
+    game_to_board(&game, board);
     jv = {
         {"turn", game.turn},
         {"p1_pieces_rm", game.p1_pieces_rem},
         {"p2_pieces_rem", game.p2_pieces_rem},
-        {"board", json::value_from(game.board)},
+        {"board", json::value_from(board)},
     };
 }
 
-void tag_invoke( json::value_from_tag, json::value &jv, move_t const &move) {
+/* json moves keep the layout of the original 4x4 records, with the drops of
+a tower move as drop0 to drop2 */
+void tag_invoke( json::value_from_tag, json::value &jv, move_info_t const &move) {
     switch(move.move) {
         case MOVE:
             jv = {
@@ -262,9 +685,9 @@ void tag_invoke( json::value_from_tag, json::value &jv, move_t const &move) {
                 {"j", move.j},
                 {"di", move.di},
                 {"dj", move.dj},
-                {"drop0", move.drop0},
-                {"drop1", move.drop1},
-                {"drop2", move.drop2},
+                {"drop0", move.drops[0]},
+                {"drop1", move.drops[1]},
+                {"drop2", move.drops[2]},
             };
             break;
         case WALL:
@@ -281,63 +704,50 @@ void tag_invoke( json::value_from_tag, json::value &jv, move_t const &move) {
                 {"j", move.j},
             };
             break;
+        case CAP:
+            jv = {
+                {"move", "CAP"},
+                {"i", move.i},
+                {"j", move.j},
+            };
+            break;
     }
 }
 
-void tag_invoke( json::value_from_tag, json::value &jv, mcts_node_t const &node) {
-    std::vector<float> p = get_prob(&node, 1);
+template <int N>
+void tag_invoke( json::value_from_tag, json::value &jv, search_record_t<N> const &record) {
+    std::vector<move_info_t> moves;
+    for (move_t move: record.moves) {
+        moves.push_back(unpack_move<N>(move));
+    }
     jv = {
-        {"game", json::value_from(node.game)},
-        {"moves", json::value_from(node.moves)},
-        {"p", json::value_from(p)},
-        {"val", node.val},
+        {"game", json::value_from(record.game)},
+        {"moves", json::value_from(moves)},
+        {"p", json::value_from(record.p)},
+        {"val", record.val},
     };
 }
 
-std::string move_to_string(move_t move) {
-    std::ostringstream stream;
-    stream << json::value_from(move);
-    return stream.str();
-}
-
-move_t string_to_move(std::string s) {
-    json::value v = json::parse(s);
-    move_t m;
-    auto o = v.as_object();
-    m.i = (uint8_t) o["i"].as_int64();
-    m.j = (uint8_t) o["j"].as_int64();
-    auto move_s = o["move"].as_string();
-    if (move_s == "FLAT") {
-        m.move = FLAT;
-    } else if (move_s == "WALL") {
-        m.move = WALL;
-    } else if (move_s == "MOVE") {
-            m.move = MOVE;
-            m.di = (uint8_t) o["di"].as_int64();
-            m.dj = (uint8_t) o["dj"].as_int64();
-            m.drop0 = (uint8_t) o["drop0"].as_int64();
-            m.drop1 = (uint8_t) o["drop1"].as_int64();
-            m.drop2 = (uint8_t) o["drop2"].as_int64();
-    } else {
-        throw std::invalid_argument("move not valid");
-    }
-    return m;
-}
-
-/* after a game has finished, record the results as json for the training data
-*/
-
-void write_results_r(mcts_node_t *node, float final_val, std::ofstream &file) {
-    if (node == NULL) {
-        return;
+/* after a game has finished, record the results as json for the training data;
+positions are written last first */
+template <int N>
+void write_json_records(const std::vector<search_record_t<N>> &records, std::ostream &file) {
+    for (int k = records.size() - 1; k >= 0; k--) {
+        file << json::value_from(records[k]);
+        file << ",";
     }
-    node->val = final_val;
-    file << json::value_from(*node);
-    file << ",";
-
-    write_results_r(node->parent, -final_val, file);
 }
 
-void write_results(mcts_node_t *final_state, std::ofstream &file) {
-    write_results_r(final_state->parent, -final_state->val, file);
-}
\ No newline at end of file
+#define INSTANTIATE_MCTS(N) \
+    template mcts_tree_t<N> *new_mcts<N>(tak_game_t<N>, evaluator_t<N> *); \
+    template void free_mcts<N>(mcts_tree_t<N> *); \
+    template std::vector<search_record_t<N>> simulate<N>(tak_game_t<N>, search_limits_t, evaluator_t<N> *); \
+    template void write_json_records<N>(const std::vector<search_record_t<N>> &, std::ostream &); \
+    template int oppose_bots<N>(tak_game_t<N>, search_limits_t, evaluator_t<N> *, evaluator_t<N> *); \
+    template int advance_root<N>(mcts_tree_t<N> *, move_t); \
+    template mcts_node_t<N> *mcts_apply_move<N>(mcts_tree_t<N> *, move_t); \
+    template void run_search<N>(mcts_tree_t<N> *, const search_limits_t *); \
+    template move_t get_move_limited<N>(mcts_tree_t<N> *, const search_limits_t *); \
+    template move_t get_move<N>(mcts_tree_t<N> *, int);
+
+FOR_EACH_BOARD_SIZE(INSTANTIATE_MCTS)
@@ -1,32 +1,127 @@
 #include "game.hpp"
 #include "ai_model.hpp"
+#include "arena.hpp"
+#include "records.hpp"
+#include <atomic>
 #include <fstream>
 
-typedef struct mcts_node_t {
-    tak_game_t game;
+/* life cycle of a node. Exactly one search worker moves a node from
+NODE_NEW to NODE_EXPANDING; the fields describing its children may only be
+read once the node is NODE_READY. */
+typedef enum {
+    NODE_NEW,
+    NODE_EXPANDING, // waiting for its evaluation
+    NODE_READY
+} node_state_t;
+
+/* nodes don't hold their position: a descent plays the moves from the root
+position down to them, and the hash is kept to check that it got there */
+template <int SIZE> // N is taken by the visit counts
+struct mcts_node_t {
+    uint64_t hash;
     float val;
-    std::vector<move_t> moves;
-    std::vector<float> P;
-    int N;
-    bool is_initialized;
+    std::atomic<uint8_t> state; // node_state_t
     bool game_ended;
-    std::vector<mcts_node_t> children;
-    mcts_node_t *parent;
-    model_t model;
-    bool use_ai;
-} mcts_node_t;
+    int idx; // index among the parent's children
+    /* statistics for the children, stored as contiguous arrays in the arena
+    when the node is initialized. W is the total value backed up through each
+    child, from the perspective of the player to move in the child. Child
+    nodes are only created the first time they are selected. W, N and the
+    child pointers are atomic since search workers update them concurrently. */
+    int n_children;
+    move_t *moves;
+    float *P;
+    std::atomic<float> *W;
+    std::atomic<int> *N;
+    std::atomic<mcts_node_t *> *children;
+};
+
+/* nodes visited by a descent, from the root to the leaf */
+#define MAX_PATH 256
+
+template <int N>
+struct search_path_t {
+    mcts_node_t<N> *nodes[MAX_PATH];
+    int len;
+    tak_game_t<N> game; // the position at the end of the path
+};
+
+/* a worker's descents waiting for evaluation */
+template <int N>
+struct search_batch_t {
+    std::vector<search_path_t<N>> paths;
+    std::vector<eval_request_t<N>> requests;
+};
+
+/* a search tree; all nodes and child statistics live in its arenas. Search
+workers other than the calling thread allocate from their own arena so
+that they never contend on allocation. Each worker also keeps its inference
+workspace and its batch of descents, the calling thread's first, so that
+once these buffers have grown a search allocates nothing outside the arenas
+and the model. */
+template <int N>
+struct mcts_tree_t {
+    arena_t arena;
+    std::vector<arena_t> worker_arenas;
+    std::vector<inference_workspace_t<N>> workspaces;
+    std::vector<search_batch_t<N>> batches;
+    mcts_node_t<N> *root;
+    tak_game_t<N> game; // the position at the root
+    evaluator_t<N> *eval; // not owned; may be shared with other trees
+};
+
+/* limits on a search; a search stops at whichever comes first, and fields
+left at 0 impose no limit, though one of the first four must be set. At
+least one batch of descents runs unless the visit limit is already met. */
+typedef struct {
+    int playouts; // descents in this search
+    int visits; // visits at the root, counting those kept from earlier moves
+    double time; // seconds of wall-clock time
+    size_t memory; // bytes held by the tree
+    /* stop once the most visited move at the root can't be overtaken within
+    the playout, visit or time limits */
+    bool early_stop;
+} search_limits_t;
+
+/* limits for a bot that searches a number of playouts or for a time per
+move; a time limit replaces the playout count unless it was given
+explicitly rather than left at its default */
+search_limits_t move_limits(int playouts, double time, bool playouts_given);
+
+template <int N>
+mcts_tree_t<N> *new_mcts(tak_game_t<N> game, evaluator_t<N> *eval);
+
+template <int N>
+void free_mcts(mcts_tree_t<N> *tree);
+
+/* play a game of the bot against itself, returning the searched positions
+with the final result filled in */
+template <int N>
+std::vector<search_record_t<N>> simulate(tak_game_t<N> game, search_limits_t limits, evaluator_t<N> *eval);
 
-mcts_node_t new_mcts(tak_game_t game, model_t &model, bool use_ai);
+/* write records as the json objects read by the python dataset, each
+followed by a comma */
+template <int N>
+void write_json_records(const std::vector<search_record_t<N>> &records, std::ostream &file);
 
-void simulate(tak_game_t game, int repetitions, std::ofstream &file, model_t &model, bool use_ai);
+template <int N>
+int oppose_bots(tak_game_t<N> game, search_limits_t limits, evaluator_t<N> *eval1, evaluator_t<N> *eval2);
 
-int oppose_bots(tak_game_t game, int repetitions, model_t &model1, model_t &model2, bool use_mcts);
 
+/* make a move at the root, keeping the subtree it leads to and freeing the
+rest of the tree; returns the number of visits kept */
+template <int N>
+int advance_root(mcts_tree_t<N> *tree, move_t move);
 
-mcts_node_t* mcts_apply_move(mcts_node_t *node, move_t move);
+template <int N>
+mcts_node_t<N>* mcts_apply_move(mcts_tree_t<N> *tree, move_t move);
 
-move_t get_move(mcts_node_t *node, int repetitions);
+template <int N>
+void run_search(mcts_tree_t<N> *tree, const search_limits_t *limits);
 
-std::string move_to_string(move_t move);
+template <int N>
+move_t get_move_limited(mcts_tree_t<N> *tree, const search_limits_t *limits);
 
-move_t string_to_move(std::string s);
+/* search with a fixed number of playouts */
+template <int N>
+move_t get_move(mcts_tree_t<N> *tree, int repetitions);
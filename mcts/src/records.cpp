@@ -0,0 +1,253 @@
+#include "records.hpp"
+#include <cmath>
+#include <cstring>
+
+template <int N>
+static constexpr int RECORD_FIXED_SIZE = 4 + 2 + 2 * wall_bytes(N) + N * N * stack_bytes(N) + 2;
+
+static void put_u16(std::vector<uint8_t> &buf, uint16_t x) {
+    buf.push_back(x & 0xFF);
+    buf.push_back(x >> 8);
+}
+
+static void put_u32(std::vector<uint8_t> &buf, uint32_t x) {
+    put_u16(buf, x & 0xFFFF);
+    put_u16(buf, x >> 16);
+}
+
+static void put_u64(std::vector<uint8_t> &buf, uint64_t x) {
+    put_u32(buf, x & 0xFFFFFFFF);
+    put_u32(buf, x >> 32);
+}
+
+/* write the low n bytes of x */
+static void put_bytes(std::vector<uint8_t> &buf, uint64_t x, int n) {
+    for (int k = 0; k < n; k++) {
+        buf.push_back((x >> (8 * k)) & 0xFF);
+    }
+}
+
+/* write the stack_bytes(N) bytes of a packed stack kept in files */
+template <int N>
+static void put_stack(std::vector<uint8_t> &buf, stack_word_t<N> stack) {
+    for (int k = 0; k < stack_bytes(N); k++) {
+        buf.push_back((uint8_t) (stack >> (8 * k)));
+    }
+}
+
+static uint16_t get_u16(const uint8_t *buf) {
+    return buf[0] | (buf[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *buf) {
+    return get_u16(buf) | ((uint32_t) get_u16(buf + 2) << 16);
+}
+
+static uint64_t get_bytes(const uint8_t *buf, int n) {
+    uint64_t x = 0;
+    for (int k = 0; k < n; k++) {
+        x |= (uint64_t) buf[k] << (8 * k);
+    }
+    return x;
+}
+
+template <int N>
+static stack_word_t<N> get_stack(const uint8_t *buf) {
+    stack_word_t<N> stack = 0;
+    for (int k = 0; k < stack_bytes(N); k++) {
+        stack |= (stack_word_t<N>) buf[k] << (8 * k);
+    }
+    return stack;
+}
+
+template <int N>
+void write_record_header(std::ostream &file) {
+    std::vector<uint8_t> buf(RECORD_MAGIC, RECORD_MAGIC + 4);
+    put_u32(buf, RECORD_VERSION);
+    put_u32(buf, N);
+    file.write((const char *) buf.data(), buf.size());
+}
+
+template <int N>
+void write_record(std::ostream &file, const search_record_t<N> *record) {
+    const tak_game_t<N> *game = &record->game;
+    int n = record->moves.size();
+    std::vector<uint8_t> buf;
+    buf.reserve(4 + RECORD_FIXED_SIZE<N> + 6 * n);
+
+    put_u32(buf, RECORD_FIXED_SIZE<N> + 6 * n);
+    buf.push_back(game->turn);
+    buf.push_back(game->p1_pieces_rem);
+    buf.push_back(game->p2_pieces_rem);
+    buf.push_back((uint8_t) (int8_t) lroundf(record->val));
+    put_u16(buf, record->ply);
+    put_bytes(buf, game->walls, wall_bytes(N));
+    put_bytes(buf, game->caps, wall_bytes(N));
+    for (int sq = 0; sq < N * N; sq++) {
+        put_stack<N>(buf, game->stacks[sq]);
+    }
+    put_u16(buf, n);
+    for (int k = 0; k < n; k++) {
+        put_u32(buf, record->moves[k]);
+    }
+    for (int k = 0; k < n; k++) {
+        put_u16(buf, (uint16_t) lroundf(record->p[k] * 65535));
+    }
+    file.write((const char *) buf.data(), buf.size());
+}
+
+int read_record_header(std::istream &file) {
+    uint8_t buf[12];
+    if (!file.read((char *) buf, sizeof(buf))) {
+        return 0;
+    }
+    if (memcmp(buf, RECORD_MAGIC, 4) != 0 || get_u32(buf + 4) != RECORD_VERSION) {
+        return 0;
+    }
+    int size = get_u32(buf + 8);
+    return size >= MIN_BOARD_SIZE && size <= MAX_BOARD_SIZE ? size : 0;
+}
+
+template <int N>
+bool read_record(std::istream &file, search_record_t<N> *record) {
+    uint8_t size_buf[4];
+    if (!file.read((char *) size_buf, sizeof(size_buf))) {
+        return false;
+    }
+    uint32_t size = get_u32(size_buf);
+    if (size < RECORD_FIXED_SIZE<N>) {
+        return false;
+    }
+    std::vector<uint8_t> buf(size);
+    if (!file.read((char *) buf.data(), size)) {
+        return false;
+    }
+
+    tak_game_t<N> *game = &record->game;
+    *game = new_tak_game<N>();
+    game->turn = buf[0];
+    game->p1_pieces_rem = buf[1];
+    game->p2_pieces_rem = buf[2];
+    record->val = (int8_t) buf[3];
+    record->ply = get_u16(&buf[4]);
+    game->walls = get_bytes(&buf[6], wall_bytes(N));
+    game->caps = get_bytes(&buf[6 + wall_bytes(N)], wall_bytes(N));
+    game->top[0] = 0;
+    game->top[1] = 0;
+    const uint8_t *stacks = &buf[6 + 2 * wall_bytes(N)];
+    for (int sq = 0; sq < N * N; sq++) {
+        stack_word_t<N> stack = get_stack<N>(stacks + stack_bytes(N) * sq);
+        game->stacks[sq] = stack;
+        if (STACK_HEIGHT(stack) > 0) {
+            game->top[(int) (stack & 1)] |= (bitboard_t<N>) 1 << sq;
+        }
+    }
+    game->p1_caps_rem = CAPS<N> - __builtin_popcountll(game->caps & game->top[0]);
+    game->p2_caps_rem = CAPS<N> - __builtin_popcountll(game->caps & game->top[1]);
+    game->hash = game_hash(game);
+
+    int n = get_u16(&buf[RECORD_FIXED_SIZE<N> - 2]);
+    if (size != RECORD_FIXED_SIZE<N> + 6 * (uint32_t) n) {
+        return false;
+    }
+    const uint8_t *moves = &buf[RECORD_FIXED_SIZE<N>];
+    const uint8_t *p = moves + 4 * n;
+    record->moves.resize(n);
+    record->p.resize(n);
+    for (int k = 0; k < n; k++) {
+        record->moves[k] = get_u32(moves + 4 * k);
+        record->p[k] = get_u16(p + 2 * k) / 65535.f;
+    }
+    return true;
+}
+
+template <int N>
+shard_writer_t<N> *new_shard_writer(const std::string &filename) {
+    shard_writer_t<N> *shard = new shard_writer_t<N>;
+    shard->file.open(filename, std::ios::binary);
+    if (!shard->file) {
+        delete shard;
+        return NULL;
+    }
+    shard->n_moves = 0;
+    // the header is rewritten once the counts are known
+    std::vector<uint8_t> header(SHARD_HEADER_SIZE, 0);
+    shard->file.write((const char *) header.data(), header.size());
+    return shard;
+}
+
+template <int N>
+void shard_write(shard_writer_t<N> *shard, const search_record_t<N> *record) {
+    const tak_game_t<N> *game = &record->game;
+    int n = record->moves.size();
+
+    shard_entry_t<N> entry;
+    entry.first_move = shard->n_moves;
+    memcpy(entry.stacks, game->stacks, sizeof(entry.stacks));
+    entry.walls = game->walls;
+    entry.caps = game->caps;
+    entry.n_moves = n;
+    entry.turn = game->turn;
+    entry.p1_pieces_rem = game->p1_pieces_rem;
+    entry.p2_pieces_rem = game->p2_pieces_rem;
+    entry.val = (int8_t) lroundf(record->val);
+    shard->index.push_back(entry);
+
+    std::vector<uint8_t> buf;
+    buf.reserve(6 * n);
+    for (int k = 0; k < n; k++) {
+        put_u32(buf, record->moves[k]);
+        put_u16(buf, (uint16_t) lroundf(record->p[k] * 65535));
+    }
+    shard->file.write((const char *) buf.data(), buf.size());
+    shard->n_moves += n;
+}
+
+template <int N>
+void close_shard_writer(shard_writer_t<N> *shard) {
+    constexpr int entry_size = shard_entry_size(N);
+    uint64_t index = SHARD_HEADER_SIZE + 6 * shard->n_moves;
+    uint64_t padding = (8 - index % 8) % 8;
+    index += padding;
+
+    std::vector<uint8_t> buf(padding, 0);
+    buf.reserve(padding + entry_size * shard->index.size());
+    for (const shard_entry_t<N> &entry: shard->index) {
+        size_t start = buf.size();
+        put_u64(buf, entry.first_move);
+        for (int sq = 0; sq < N * N; sq++) {
+            put_stack<N>(buf, entry.stacks[sq]);
+        }
+        put_bytes(buf, entry.walls, wall_bytes(N));
+        put_bytes(buf, entry.caps, wall_bytes(N));
+        put_u16(buf, entry.n_moves);
+        buf.push_back(entry.turn);
+        buf.push_back(entry.p1_pieces_rem);
+        buf.push_back(entry.p2_pieces_rem);
+        buf.push_back((uint8_t) entry.val);
+        buf.resize(start + entry_size, 0);
+    }
+    shard->file.write((const char *) buf.data(), buf.size());
+
+    buf.assign(SHARD_MAGIC, SHARD_MAGIC + 4);
+    put_u32(buf, SHARD_VERSION);
+    put_u32(buf, N);
+    put_u32(buf, entry_size);
+    put_u64(buf, shard->index.size());
+    put_u64(buf, shard->n_moves);
+    put_u64(buf, index);
+    shard->file.seekp(0);
+    shard->file.write((const char *) buf.data(), buf.size());
+    shard->file.close();
+    delete shard;
+}
+
+#define INSTANTIATE_RECORDS(N) \
+    template void write_record_header<N>(std::ostream &); \
+    template void write_record<N>(std::ostream &, const search_record_t<N> *); \
+    template bool read_record<N>(std::istream &, search_record_t<N> *); \
+    template shard_writer_t<N> *new_shard_writer<N>(const std::string &); \
+    template void shard_write<N>(shard_writer_t<N> *, const search_record_t<N> *); \
+    template void close_shard_writer<N>(shard_writer_t<N> *);
+
+FOR_EACH_BOARD_SIZE(INSTANTIATE_RECORDS)
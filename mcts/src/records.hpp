@@ -0,0 +1,136 @@
+#ifndef RECORDS_H_
+#define RECORDS_H_
+
+#include "game.hpp"
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+/* a searched position kept for the training data: the moves from it, the
+search's visit distribution over them and the final result of the game for
+the player to move */
+template <int N>
+struct search_record_t {
+    tak_game_t<N> game;
+    std::vector<move_t> moves;
+    std::vector<float> p;
+    float val;
+    int ply; // moves played in the game before this position
+};
+
+/* bytes of the walls and caps bitboards in records and shards */
+constexpr int wall_bytes(int n) {
+    return (n * n + 7) / 8;
+}
+
+/* bytes of a packed stack in records and shards: the low bytes of its
+word, which hold an owner bit for every piece and the height marker */
+constexpr int stack_bytes(int n) {
+    return (2 * (PIECES_BY_SIZE[n] + CAPS_BY_SIZE[n]) + 1 + 7) / 8;
+}
+
+/* Binary self-play records. A file starts with the magic "TAKR", a uint32
+version and the uint32 board size N, followed by records, each prefixed by
+its size in bytes so that readers can skip them. All fields are
+little-endian:
+
+    uint32 size        bytes in the rest of the record
+    uint8  turn
+    uint8  p1_pieces_rem
+    uint8  p2_pieces_rem
+    int8   val         final result for the player to move: -1, 0 or 1
+    uint16 ply         moves played before the position; 0 starts a new game
+    uint8  walls[(N * N + 7) / 8]  bitboard of squares with a wall on top
+    uint8  caps[(N * N + 7) / 8]   and with a capstone on top
+    uint8  stacks[N * N][stack_bytes(N)]  packed stacks, as in tak_game_t
+    uint16 n_moves
+    uint32 moves[n]    packed moves, which are policy head indices
+    uint16 p[n]        visit distribution scaled so that it sums to ~65535
+
+Capstones in reserve aren't stored: every capstone played is on top of a
+stack, so they follow from the caps bitboard. Games are appended as they
+finish, so a file can be read while it grows. */
+#define RECORD_MAGIC "TAKR"
+#define RECORD_VERSION 1
+
+template <int N>
+void write_record_header(std::ostream &file);
+
+template <int N>
+void write_record(std::ostream &file, const search_record_t<N> *record);
+
+/* check the magic and version at the start of a file; returns the board
+size, or 0 if the header isn't valid */
+int read_record_header(std::istream &file);
+
+/* read the next record; false at the end of the file or on a bad record */
+template <int N>
+bool read_record(std::istream &file, search_record_t<N> *record);
+
+/* Training shards: a random-access counterpart to the record stream, meant
+to be memory-mapped by the trainer. All fields are little-endian:
+
+    char   magic[4]    "TAKS"
+    uint32 version
+    uint32 board_size  N
+    uint32 entry_size  bytes per position
+    uint64 n_records
+    uint64 n_moves     entries in the move table
+    uint64 index       offset of the position table, a multiple of 8
+    moves[n_moves]                    6 bytes each:
+        uint32 move         packed move
+        uint16 p            as above
+    positions[n_records]              at offset index, each of them
+        uint64 first_move   index into the move table
+        uint8  stacks[N * N][stack_bytes(N)]
+        uint8  walls[(N * N + 7) / 8]
+        uint8  caps[(N * N + 7) / 8]
+        uint16 n_moves
+        uint8  turn, p1_pieces_rem, p2_pieces_rem
+        int8   val
+        padding to a multiple of 8 bytes
+
+Every position has the same size, so position k sits at index + entry_size
+* k and its moves at 40 + 6 * first_move. The header and the position table
+are only written once the shard is closed. */
+#define SHARD_MAGIC "TAKS"
+#define SHARD_VERSION 1
+#define SHARD_HEADER_SIZE 40
+
+constexpr int shard_entry_size(int n) {
+    return (8 + stack_bytes(n) * n * n + 2 * wall_bytes(n) + 2 + 4 + 7) / 8 * 8;
+}
+
+template <int N>
+struct shard_entry_t {
+    uint64_t first_move;
+    stack_word_t<N> stacks[N * N];
+    bitboard_t<N> walls;
+    bitboard_t<N> caps;
+    uint16_t n_moves;
+    uint8_t turn;
+    uint8_t p1_pieces_rem;
+    uint8_t p2_pieces_rem;
+    int8_t val;
+};
+
+template <int N>
+struct shard_writer_t {
+    std::ofstream file;
+    std::vector<shard_entry_t<N>> index;
+    uint64_t n_moves;
+};
+
+/* start a shard; returns NULL if the file can't be created */
+template <int N>
+shard_writer_t<N> *new_shard_writer(const std::string &filename);
+
+template <int N>
+void shard_write(shard_writer_t<N> *shard, const search_record_t<N> *record);
+
+/* write out the position table and header, then close the file */
+template <int N>
+void close_shard_writer(shard_writer_t<N> *shard);
+
+#endif // define RECORDS_H_
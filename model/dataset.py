@@ -1,13 +1,17 @@
 from torch.utils.data import Dataset, DataLoader
+import functools
 import json
+import struct
+import numpy as np
 import torch
 
 WALL_OFFSET = 10
+CAP_OFFSET = 20
 
 # output tensor channel dimensions:
 # - 4 - i
 # - 4 - j
-# - 6 - flat,wall,left,right,up,down
+# - 6 - flat,wall,left,right,up,down (and cap, on boards with capstones)
 # - 7 - drop0
 # - 8 - drop1
 # - 8 - drop2
@@ -48,9 +52,16 @@ def encode_move(move):
                 1,
                 0, 0, 0,
             )
+        case "CAP":
+            return (
+                move['i'],
+                move['j'],
+                6,
+                0, 0, 0,
+            )
         
 def encode_board(game):
-    assert WALL_OFFSET == 10
+    assert WALL_OFFSET == 10 and CAP_OFFSET == 20
     def map_n(n):
         match n:
             case 1:
@@ -61,6 +72,10 @@ def encode_board(game):
                 return -2
             case 12:
                 return 2
+            case 21:
+                return -3
+            case 22:
+                return 3
             case 0:
                 return 0
             case _:
@@ -73,6 +88,230 @@ def encode_board(game):
     
     return [[[flip(map_n(n)) for n in col] for col in row] for row in game['board']]
 
+# binary self-play records written by takMCTS, see mcts/src/records.hpp
+RECORD_MAGIC = b"TAKR"
+RECORD_VERSION = 1
+RECORD_HEADER = struct.Struct("<4sII") # magic, version, board size
+
+# stones and capstones each player starts with, as in mcts/src/game.hpp
+PIECES_BY_SIZE = {3: 10, 4: 15, 5: 21, 6: 30, 7: 40, 8: 50}
+CAPS_BY_SIZE = {3: 0, 4: 0, 5: 1, 6: 1, 7: 2, 8: 2}
+
+def wall_bytes(size):
+    return (size * size + 7) // 8
+
+def stack_bytes(size):
+    """bytes of a packed stack: an owner bit for every piece of the game,
+    then the height marker, as stack_bytes() in mcts/src/records.hpp"""
+    return (2 * (PIECES_BY_SIZE[size] + CAPS_BY_SIZE[size]) + 1 + 7) // 8
+
+@functools.cache
+def record_fixed(size):
+    """turn, pieces remaining, val, ply, walls, caps, stacks, n_moves"""
+    return struct.Struct(f"<BBBbH{wall_bytes(size)}s{wall_bytes(size)}s{size * size * stack_bytes(size)}sH")
+
+def policy_types(size):
+    """move types in the policy head, as POLICY_TYPES in mcts/src/game.hpp;
+    boards from 5x5 up have capstones, which get a seventh type"""
+    return 7 if size >= 5 else 6
+
+def policy_drops(size):
+    """drops part of the policy head, as POLICY_DROPS in mcts/src/game.hpp"""
+    if size <= 4:
+        return 7 * 8 ** (size - 2)
+    # a tower move carries up to size pieces
+    return sum(1 for c in range(1, size + 1) for mask in range(1 << (c - 1))
+               if bin(mask).count("1") + 1 < size)
+
+def decode_move(idx, size=4):
+    """packed move (its flat policy index) to the tuple given by encode_move.
+    Up to 4x4 the drops are spelled out; on larger boards they stay a single
+    code, as in the policy head."""
+    n_drops = policy_drops(size)
+    sq, rest = divmod(int(idx), policy_types(size) * n_drops)
+    move_type, drops = divmod(rest, n_drops)
+    if size > 4:
+        return (sq // size, sq % size, move_type, drops)
+    digits = tuple((drops // 8 ** k) % 8 for k in reversed(range(size - 1)))
+    return (sq // size, sq % size, move_type, *digits)
+
+# bits up to and including the highest set bit of each byte value
+BIT_LENGTH = np.array([int(x).bit_length() for x in range(256)], dtype=np.int64)
+
+def unpack_stacks(stacks):
+    """packed stacks, as a [..., stack_bytes] uint8 array, to their heights
+    and the owner bits of their top 9 pieces. The height is the position of
+    the highest set bit, the marker; the bits from it up in the owners are
+    not pieces and are masked by the heights."""
+    stacks = stacks.astype(np.int64)
+    # the last nonzero byte, which holds the marker; 0 for empty squares
+    top = stacks.shape[-1] - 1 - np.argmax(stacks[..., ::-1] != 0, axis=-1)
+    top_byte = np.take_along_axis(stacks, top[..., None], axis=-1)[..., 0]
+    heights = np.where(top_byte > 0, 8 * top + BIT_LENGTH[top_byte] - 1, 0)
+    return heights, stacks[..., 0] | stacks[..., 1] << 8
+
+def decode_board(turn, walls, caps, stacks, size=4):
+    """the bytes of the packed stacks and of the walls and caps bitboards to
+    the same [size][size][9] values as encode_board"""
+    heights, owners = unpack_stacks(np.frombuffer(stacks, dtype=np.uint8).reshape(size * size, -1))
+    depth = np.arange(9)
+    present = depth[None, :] < heights[:, None]
+    p2 = (owners[:, None] >> depth[None, :]) & 1
+    board = np.where(present, np.where(p2 == 1, 1.0, -1.0), 0.0)
+    wall = np.unpackbits(np.frombuffer(walls, dtype=np.uint8), bitorder="little")[:size * size]
+    cap = np.unpackbits(np.frombuffer(caps, dtype=np.uint8), bitorder="little")[:size * size]
+    board[:, 0] *= 1.0 + wall + 2.0 * cap
+    if turn == 2:
+        board = -board
+    return board.reshape(size, size, 9).astype(np.float32)
+
+def decode_record(buf, size=4):
+    """decode a record without its size prefix"""
+    fixed = record_fixed(size)
+    turn, p1_rem, p2_rem, val, ply, walls, caps, stacks, n = fixed.unpack_from(buf)
+    moves = np.frombuffer(buf, dtype="<u4", count=n, offset=fixed.size)
+    p = np.frombuffer(buf, dtype="<u2", count=n, offset=fixed.size + 4 * n).astype(np.float32)
+    return {
+        "board": decode_board(turn, walls, caps, stacks, size),
+        "moves": moves,
+        "p": p / max(p.sum(), 1.0),
+        "val": float(val),
+        "ply": ply,
+        "size": size,
+    }
+
+def record_sample(record):
+    """a decoded record as a training sample, in the format of TakDataset"""
+    move_idxs = [decode_move(m, record["size"]) for m in record["moves"]]
+    return (
+        torch.from_numpy(record["board"]),
+        (move_idxs, torch.from_numpy(record["p"]), record["val"])
+    )
+
+def read_record_header(f):
+    """check the header of a record file and return its board size"""
+    magic, version, size = RECORD_HEADER.unpack(f.read(RECORD_HEADER.size))
+    assert magic == RECORD_MAGIC and version == RECORD_VERSION, f"not a v{RECORD_VERSION} record file"
+    return size
+
+def iter_records(file):
+    """stream the records of a file one at a time"""
+    with open(file, "rb") as f:
+        board_size = read_record_header(f)
+        while len(size := f.read(4)) == 4:
+            (n,) = struct.unpack("<I", size)
+            yield decode_record(f.read(n), board_size)
+
+class TakRecordDataset(Dataset):
+    """dataset over a binary record file; only the offset of each record is
+    kept in memory and records are read from the file when requested"""
+    def __init__(self, file) -> None:
+        super().__init__()
+        self.file = file
+        self.f = None
+        offsets = []
+        with open(file, "rb") as f:
+            self.size = read_record_header(f)
+            pos = f.tell()
+            while len(size := f.read(4)) == 4:
+                (n,) = struct.unpack("<I", size)
+                offsets.append((pos + 4, n))
+                pos += 4 + n
+                f.seek(pos)
+        self.offsets = np.array(offsets, dtype=np.int64).reshape(-1, 2)
+
+    def __len__(self):
+        return len(self.offsets)
+
+    def __getitem__(self, i):
+        if self.f is None:
+            # opened lazily so that each data loader worker gets its own handle
+            self.f = open(self.file, "rb")
+        pos, n = self.offsets[i]
+        self.f.seek(pos)
+        return record_sample(decode_record(self.f.read(n), self.size))
+
+# training shards written by takMCTS --shard, see mcts/src/records.hpp
+SHARD_MAGIC = b"TAKS"
+SHARD_VERSION = 1
+SHARD_HEADER = struct.Struct("<4sIIIQQQ")
+SHARD_MOVE = np.dtype([("move", "<u4"), ("p", "<u2")])
+
+def shard_entry(size, entry_size):
+    """dtype of a shard position on a size x size board"""
+    fields = np.dtype([
+        ("first_move", "<u8"),
+        ("stacks", "u1", (size * size, stack_bytes(size))),
+        ("walls", "u1", (wall_bytes(size),)),
+        ("caps", "u1", (wall_bytes(size),)),
+        ("n_moves", "<u2"),
+        ("turn", "u1"),
+        ("p1_pieces_rem", "u1"),
+        ("p2_pieces_rem", "u1"),
+        ("val", "i1"),
+    ], align=False)
+    return np.dtype({
+        "names": fields.names,
+        "formats": [fields.fields[f][0] for f in fields.names],
+        "offsets": [fields.fields[f][1] for f in fields.names],
+        "itemsize": entry_size,
+    })
+
+def decode_boards(entries, out):
+    """decode a batch of shard positions into out, a [B][size][size][9] float
+    array, with the same values as encode_board"""
+    squares = entries["stacks"].shape[1]
+    heights, owners = unpack_stacks(entries["stacks"])
+    depth = np.arange(9)
+    present = depth < heights[..., None]
+    p2 = (owners[..., None] >> depth) & 1
+    # +1 for pieces of p2, -1 for p1, negated when p2 is to move
+    sign = np.where(entries["turn"] == 2, -1.0, 1.0)[:, None, None]
+    board = out.reshape(len(entries), squares, 9)
+    np.multiply(present * (2 * p2 - 1), sign, out=board)
+    walls = np.unpackbits(entries["walls"], axis=1, bitorder="little")[:, :squares]
+    caps = np.unpackbits(entries["caps"], axis=1, bitorder="little")[:, :squares]
+    board[:, :, 0] *= 1 + walls + 2 * caps
+    return out
+
+class TakShardDataset(Dataset):
+    """dataset over a memory-mapped training shard. Positions are looked up
+    by index in the fixed-stride position table without reading the rest of
+    the file, and __getitems__ decodes a whole batch of boards at once into a
+    buffer kept for the next batch."""
+    def __init__(self, file) -> None:
+        super().__init__()
+        self.file = file
+        self.boards = None
+        data = np.memmap(file, dtype=np.uint8, mode="r")
+        magic, version, self.size, entry_size, n_records, n_moves, index = SHARD_HEADER.unpack_from(data)
+        assert magic == SHARD_MAGIC and version == SHARD_VERSION, f"not a v{SHARD_VERSION} shard"
+        self.moves = data[SHARD_HEADER.size:SHARD_HEADER.size + SHARD_MOVE.itemsize * n_moves].view(SHARD_MOVE)
+        self.entries = data[index:index + entry_size * n_records].view(shard_entry(self.size, entry_size))
+
+    def __len__(self):
+        return len(self.entries)
+
+    def policy(self, entry):
+        moves = self.moves[entry["first_move"]:entry["first_move"] + entry["n_moves"]]
+        p = moves["p"].astype(np.float32)
+        move_idxs = [decode_move(m, self.size) for m in moves["move"]]
+        return (move_idxs, torch.from_numpy(p / max(p.sum(), 1.0)), float(entry["val"]))
+
+    def __getitems__(self, idxs):
+        """the boards are views into the buffer, so they only hold until the
+        next call; tak_collate_fn copies them out with torch.stack"""
+        entries = self.entries[np.asarray(idxs)]
+        if self.boards is None or len(self.boards) < len(idxs):
+            self.boards = torch.empty((len(idxs), self.size, self.size, 9))
+        boards = self.boards[:len(idxs)]
+        decode_boards(entries, boards.numpy())
+        return [(boards[b], self.policy(entry)) for b, entry in enumerate(entries)]
+
+    def __getitem__(self, i):
+        board, policy = self.__getitems__([i])[0]
+        return board.clone(), policy
+
 class TakDataset(Dataset):
     def __init__(self, file) -> None:
         super().__init__()
@@ -102,6 +341,11 @@ def tak_collate_fn(batch):
     )
 
 def get_tak_dataloader(file, **kwargs):
-    ds = TakDataset(file)
+    if file.endswith(".json"):
+        ds = TakDataset(file)
+    elif file.endswith(".shard"):
+        ds = TakShardDataset(file)
+    else:
+        ds = TakRecordDataset(file)
     loader = DataLoader(ds, collate_fn=tak_collate_fn, shuffle=True, num_workers=2,**kwargs)
     return loader
\ No newline at end of file
@@ -0,0 +1,156 @@
+from collections import deque
+import glob
+import os
+import struct
+import threading
+import numpy as np
+from dataset import RECORD_HEADER, decode_record, record_sample, read_record_header, tak_collate_fn
+
+class RecordTail():
+    """reads the records appended to a growing record stream since the last
+    call; a record that is only partly written is left for the next call"""
+    def __init__(self, file) -> None:
+        self.file = file
+        self.pos = 0
+        self.size = None # board size, once the header is read
+
+    def read(self):
+        records = []
+        with open(self.file, "rb") as f:
+            if self.pos == 0:
+                if os.fstat(f.fileno()).st_size < RECORD_HEADER.size:
+                    return records
+                self.size = read_record_header(f)
+                self.pos = RECORD_HEADER.size
+            f.seek(self.pos)
+            data = f.read()
+        offset = 0
+        while offset + 4 <= len(data):
+            (n,) = struct.unpack_from("<I", data, offset)
+            if offset + 4 + n > len(data):
+                break
+            records.append(data[offset + 4:offset + 4 + n])
+            offset += 4 + n
+        self.pos += offset
+        return records
+
+class ReplayBuffer():
+    """rolling window over the newest self-play games, for training while
+    generation runs.
+
+    Games come from add_game, or from the record streams matching a glob
+    pattern, which refresh tails. Every self-play thread of takMCTS writes its
+    own stream, so they append concurrently without coordination; a record
+    with ply 0 starts a new game. Once more than capacity games are held the
+    oldest are dropped.
+
+    Positions are sampled with probability proportional to priority ** alpha,
+    so alpha = 0 samples uniformly. New positions get the largest priority
+    seen so far, and update_priorities sets them from the training loss.
+    Every game must be played on the same board size."""
+    def __init__(self, capacity, pattern=None, alpha=0.0, beta=0.4, size=4) -> None:
+        self.capacity = capacity
+        self.size = size
+        self.pattern = pattern
+        self.alpha = alpha
+        self.beta = beta
+        self.games = deque()
+        self.n_games = 0 # games ever added, so games keep their id once older ones are dropped
+        self.max_priority = 1.0
+        self.tails = {}
+        self.lock = threading.Lock()
+
+    def __len__(self):
+        return sum(len(game["records"]) for game in self.games)
+
+    def add_game(self, records):
+        """add a game given as a list of raw records, without their size prefix"""
+        with self.lock:
+            self._new_game(records)
+
+    def _new_game(self, records):
+        game = {"id": self.n_games, "records": [], "priorities": np.zeros(0)}
+        self._extend_game(game, records)
+        self.games.append(game)
+        self.n_games += 1
+        while len(self.games) > self.capacity:
+            self.games.popleft()
+        return game
+
+    def _extend_game(self, game, records):
+        game["records"].extend(records)
+        priorities = np.full(len(records), self.max_priority)
+        self._set_priorities(game, np.concatenate([game["priorities"], priorities]))
+
+    def _set_priorities(self, game, priorities):
+        # cache the sampling weights so that drawing a batch doesn't raise the whole window to alpha
+        game["priorities"] = priorities
+        game["weights"] = priorities ** self.alpha
+        game["total"] = game["weights"].sum()
+
+    def refresh(self):
+        """pick up the records written to the streams since the last refresh;
+        returns the number of records read"""
+        if self.pattern is None:
+            return 0
+        n = 0
+        for file in sorted(glob.glob(self.pattern)):
+            if file not in self.tails:
+                self.tails[file] = (RecordTail(file), None)
+            tail, game = self.tails[file]
+            records = tail.read()
+            assert tail.size in (None, self.size), f"{file} is for {tail.size}x{tail.size} boards"
+            n += len(records)
+            with self.lock:
+                pending = []
+                for record in records:
+                    (ply,) = struct.unpack_from("<H", record, 4)
+                    if ply == 0 or game is None:
+                        if pending:
+                            self._extend_game(game, pending)
+                            pending = []
+                        game = self._new_game([])
+                    pending.append(record)
+                if pending:
+                    self._extend_game(game, pending)
+            self.tails[file] = (tail, game)
+        return n
+
+    def sample(self, batch_size, rng=np.random):
+        """draw a batch in the format of tak_collate_fn. Also returns keys for
+        update_priorities and the importance sampling weight of each sample,
+        which are all 1 when sampling uniformly."""
+        with self.lock:
+            games = [game for game in self.games if len(game["records"]) > 0]
+            assert len(games) > 0, "replay buffer is empty"
+            totals = np.array([game["total"] for game in games])
+            total = totals.sum()
+            n = sum(len(game["records"]) for game in games)
+
+            samples, keys, probs = [], [], []
+            for g in rng.choice(len(games), size=batch_size, p=totals / total):
+                weights = games[g]["weights"]
+                k = rng.choice(len(weights), p=weights / totals[g])
+                samples.append(record_sample(decode_record(games[g]["records"][k], self.size)))
+                keys.append((games[g]["id"], k))
+                probs.append(weights[k] / total)
+
+        is_weights = (n * np.array(probs)) ** -self.beta
+        return tak_collate_fn(samples), keys, is_weights / is_weights.max()
+
+    def update_priorities(self, keys, priorities):
+        """set the priorities of sampled positions, skipping those of games
+        dropped since they were sampled"""
+        with self.lock:
+            if len(self.games) == 0:
+                return
+            first = self.games[0]["id"]
+            updated = {}
+            for (game_id, k), priority in zip(keys, priorities):
+                if game_id >= first:
+                    game = self.games[game_id - first]
+                    game["priorities"][k] = priority
+                    updated[game_id] = game
+                    self.max_priority = max(self.max_priority, priority)
+            for game in updated.values():
+                self._set_priorities(game, game["priorities"])
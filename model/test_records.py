@@ -0,0 +1,58 @@
+"""Round trip of the binary self-play formats: takFixture (mcts/fixture.cpp)
+writes the same positions as a record stream, a training shard and json, and
+the records and shards must decode to the boards, moves and visit
+distributions that encode_board and encode_move give for the json. Run with
+
+    takFixture --out /tmp/fixture
+    TAK_FIXTURE=/tmp/fixture python -m pytest test_records.py
+
+or python test_records.py /tmp/fixture."""
+import os
+import sys
+import numpy as np
+from dataset import TakDataset, TakRecordDataset, TakShardDataset, encode_board, encode_move, iter_records
+
+def fixture_prefix():
+    prefix = os.environ.get("TAK_FIXTURE")
+    if prefix is None:
+        import pytest
+        pytest.skip("TAK_FIXTURE isn't set to the prefix of a takFixture output")
+    return prefix
+
+def json_order(prefix):
+    """index in the record stream of each json position: both hold the same
+    games, but json games are written last position first"""
+    plies = [record["ply"] for record in iter_records(prefix + ".bin")]
+    starts = [k for k, ply in enumerate(plies) if ply == 0] + [len(plies)]
+    return [k for start, end in zip(starts, starts[1:]) for k in reversed(range(start, end))]
+
+def load_fixture():
+    prefix = fixture_prefix()
+    positions = TakDataset(prefix + ".json").data
+    order = json_order(prefix)
+    assert len(order) == len(positions) > 0
+    return positions, order, [TakRecordDataset(prefix + ".bin"), TakShardDataset(prefix + ".shard")]
+
+def test_boards():
+    positions, order, datasets = load_fixture()
+    for position, k in zip(positions, order):
+        board = np.array(encode_board(position["game"]), dtype=np.float32)
+        for ds in datasets:
+            assert np.array_equal(np.asarray(ds[k][0]), board)
+
+def test_moves():
+    positions, order, datasets = load_fixture()
+    for position, k in zip(positions, order):
+        moves = [encode_move(m) for m in position["moves"]]
+        for ds in datasets:
+            move_idxs, p, val = ds[k][1]
+            assert move_idxs == moves
+            # p is stored in 16 bits
+            assert np.allclose(np.asarray(p), position["p"], atol=1e-4)
+            assert val == position["val"]
+
+if __name__ == "__main__":
+    os.environ["TAK_FIXTURE"] = sys.argv[1]
+    test_boards()
+    test_moves()
+    print("ok")
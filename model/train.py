@@ -4,6 +4,8 @@ from tensorboardX import SummaryWriter
 import torch.nn.functional as F
 from model import TakNet
 from dataset import get_tak_dataloader
+from replay import ReplayBuffer
+import time
 import click
 from torch import Tensor
 
@@ -13,27 +15,37 @@ class TrainState():
     optim: torch.optim.Optimizer
     device: str
 
-def strategy_loss(pred_vals: Tensor, pred_policy: Tensor, idxs: list[tuple], vals: Tensor, ps: list[Tensor]):
+def strategy_loss(pred_vals: Tensor, pred_policy: Tensor, idxs: list[tuple], vals: Tensor, ps: list[Tensor], weights: Tensor | None = None):
+    """policy and value losses averaged over the batch, each sample scaled by
+    its weight if given. Also returns the unweighted loss of each sample."""
     B = len(idxs)
+    if weights is None:
+        weights = torch.ones(B, device=pred_vals.device)
 
     pred_logits = torch.log_softmax(pred_policy.view((B,-1)), 1).view(pred_policy.shape)
 
+    sample_losses = []
     policy_loss = 0.
     for b in range(B):
+        sample_loss = 0.
         for i in range(len(idxs[b])):
             idx = idxs[b][i]
             pred_logit = pred_logits[b][idx]
-            policy_loss -= ps[b][i] * pred_logit # cross entropy
+            sample_loss -= ps[b][i] * pred_logit # cross entropy
+        policy_loss += weights[b] * sample_loss
+        sample_losses.append(float(sample_loss))
     
     policy_loss /= B;
     
-    val_loss = ((vals.flatten() - pred_vals.flatten())**2).sum() / B
+    val_errors = (vals.flatten() - pred_vals.flatten())**2
+    val_loss = (weights * val_errors).sum() / B
 
-    return policy_loss, val_loss
+    sample_losses = [p + float(v) for p, v in zip(sample_losses, val_errors)]
+    return policy_loss, val_loss, sample_losses
 
     
 
-def loss_f(data, train_state):
+def loss_f(data, train_state, weights=None):
     X, (idxs, p, vals) = data
     X = X.to(train_state.device)
     p = p
@@ -41,7 +53,7 @@ def loss_f(data, train_state):
 
     pred_vals, pred_policy = train_state.net.forward(X)
 
-    return strategy_loss(pred_vals, pred_policy, idxs, vals, p)
+    return strategy_loss(pred_vals, pred_policy, idxs, vals, p, weights)
     
 def train(datafile, logfolder, l, device, epochs, batch_size):
     net = torch.compile(TakNet()).to(device)
@@ -55,7 +67,7 @@ def train(datafile, logfolder, l, device, epochs, batch_size):
     step = 0
     for epoch in range(epochs):
         for data in loader:                
-            policy_loss, val_loss = loss_f(data, state)
+            policy_loss, val_loss, _ = loss_f(data, state)
 
             writer.add_scalar("loss/policy", policy_loss, step)
             writer.add_scalar("loss/value", val_loss, step)
@@ -72,17 +84,63 @@ def train(datafile, logfolder, l, device, epochs, batch_size):
 
         torch.save(state.net.state_dict(), f"{logfolder}/model_epoch{epoch}.pt")
 
+def train_replay(pattern, logfolder, l, device, steps, batch_size, capacity, alpha, save_every):
+    """train continuously on a replay buffer over the record streams that
+    self-play is writing, picking up new games as they finish"""
+    net = torch.compile(TakNet()).to(device)
+    buffer = ReplayBuffer(capacity, pattern, alpha=alpha)
+    writer = SummaryWriter(logfolder)
+
+    optim = torch.optim.AdamW(net.parameters())
+
+    state = TrainState(net, optim, device)
+
+    while len(buffer) < batch_size:
+        buffer.refresh()
+        time.sleep(1)
+
+    for step in range(steps):
+        if step % 100 == 0:
+            buffer.refresh()
+        data, keys, weights = buffer.sample(batch_size)
+        weights = torch.tensor(weights, dtype=torch.float32, device=device)
+        policy_loss, val_loss, sample_losses = loss_f(data, state, weights)
+        buffer.update_priorities(keys, sample_losses)
+
+        writer.add_scalar("loss/policy", policy_loss, step)
+        writer.add_scalar("loss/value", val_loss, step)
+        writer.add_scalar("replay/positions", len(buffer), step)
+
+        loss = policy_loss + l * val_loss
+
+        state.optim.zero_grad()
+        loss.backward()
+        state.optim.step()
+
+        print(f"step {step}/{steps}, loss {loss}, policy loss {policy_loss}, value loss {val_loss}")
+
+        if (step + 1) % save_every == 0:
+            torch.save(state.net.state_dict(), f"{logfolder}/model_step{step + 1}.pt")
+
 @click.command()
-@click.option("--datafile", type=str, required=True)
+@click.option("--datafile", type=str)
+@click.option("--replay", type=str, help="glob of record streams to train on continuously, e.g. 'games/*.bin'")
 @click.option("--logfolder", type=str, required=True)
 @click.option("--device", default="cuda")
-@click.option("--epochs", type=int, required = True)
+@click.option("--epochs", type=int, default=1)
+@click.option("--steps", type=int, default=100000, help="training steps with --replay")
+@click.option("--capacity", type=int, default=10000, help="games kept in the replay buffer")
+@click.option("--alpha", type=float, default=0, help="prioritization of the replay buffer (0 for uniform)")
+@click.option("--save-every", type=int, default=5000)
 @click.option("--batch-size", default=64)
 @click.option("--l", type=float, default = 1)
-def main(datafile, logfolder, device, epochs, l, batch_size):
-    train(datafile, logfolder, l, device, epochs, batch_size)
+def main(datafile, replay, logfolder, device, epochs, steps, capacity, alpha, save_every, l, batch_size):
+    if replay is not None:
+        train_replay(replay, logfolder, l, device, steps, batch_size, capacity, alpha, save_every)
+    elif datafile is not None:
+        train(datafile, logfolder, l, device, epochs, batch_size)
+    else:
+        raise click.UsageError("specify --datafile or --replay")
 
 if __name__ == "__main__":
     main()
-
-